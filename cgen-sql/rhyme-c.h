@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/mman.h>
@@ -84,6 +85,12 @@ int compare_str2(const char *str1, int len1, const char *str2, int len2) {
     return strncmp(str1, str2, min_len);
 }
 
+// order of two strings, a prefix comes first (as in the sort compare)
+int compare_str3(const char *str1, int len1, const char *str2, int len2) {
+    int res = strncmp(str1, str2, (len1 < len2) ? len1 : len2);
+    return res ? res : len1 - len2;
+}
+
 void println(const char *file, int start, int end) {
     int curr = start;
     while (curr < end) {
@@ -115,6 +122,188 @@ void print_date(int date) {
     printf("%04d-%02d-%02d", year, month, day); // Print in yyyy-mm-dd format
 }
 
+// Buffered result output. Generated code appends the result to out_buf and
+// out_flush writes it to stdout with as few write() calls as possible.
+#define OUT_BUF_SIZE (1 << 22)
+
+char out_buf[OUT_BUF_SIZE];
+size_t out_pos = 0;
+// bytes already written to stdout
+size_t out_flushed = 0;
+
+void out_write_raw(const char *str, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(1, str, len);
+        if (n <= 0) exit(1);
+        str += n;
+        len -= n;
+    }
+}
+
+#ifdef RHYME_SERVER
+// In server mode every response is sent as chunks of <u32 length><data>,
+// terminated by an empty chunk (see server_end_request)
+void out_write(const char *str, size_t len) {
+    if (len == 0) return;
+    uint32_t n = len;
+    out_write_raw((const char *)&n, sizeof(n));
+    out_write_raw(str, len);
+}
+#else
+#define out_write out_write_raw
+#endif
+
+void out_flush() {
+    out_write(out_buf, out_pos);
+    out_flushed += out_pos;
+    out_pos = 0;
+}
+
+// Anything still buffered is written when the program exits
+__attribute__((destructor)) void out_flush_at_exit() {
+    out_flush();
+}
+
+void out_str(const char *str, size_t len) {
+    if (out_pos + len > OUT_BUF_SIZE) {
+        out_flush();
+        if (len > OUT_BUF_SIZE) {
+            out_write(str, len);
+            out_flushed += len;
+            return;
+        }
+    }
+    memcpy(out_buf + out_pos, str, len);
+    out_pos += len;
+}
+
+void out_char(char c) {
+    if (out_pos == OUT_BUF_SIZE) out_flush();
+    out_buf[out_pos++] = c;
+}
+
+// printf into the output buffer, for output without a specialized writer
+void out_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out_buf + out_pos, OUT_BUF_SIZE - out_pos, fmt, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n < OUT_BUF_SIZE - out_pos) {
+        out_pos += n;
+        return;
+    }
+    out_flush();
+    char *tmp = malloc(n + 1);
+    va_start(args, fmt);
+    vsnprintf(tmp, n + 1, fmt, args);
+    va_end(args);
+    out_str(tmp, n);
+    free(tmp);
+}
+
+// Binary output of a value with its in-memory representation
+#define out_raw(type, v)                                 \
+    do {                                                 \
+        type out_tmp = (v);                              \
+        out_str((const char *)&out_tmp, sizeof(type));   \
+    } while (0)
+
+// Pad the output with zero bytes to a multiple of n
+void out_align(size_t n) {
+    size_t pos = out_flushed + out_pos;
+    while (pos % n != 0) {
+        out_char(0);
+        pos++;
+    }
+}
+
+const char out_digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Write v with at least width digits (zero padded)
+void out_uint_pad(uint64_t v, int width) {
+    char tmp[20];
+    int i = 20;
+    while (v >= 100) {
+        int r = (v % 100) * 2;
+        v /= 100;
+        tmp[--i] = out_digits[r + 1];
+        tmp[--i] = out_digits[r];
+    }
+    if (v >= 10) {
+        tmp[--i] = out_digits[v * 2 + 1];
+        tmp[--i] = out_digits[v * 2];
+    } else {
+        tmp[--i] = '0' + v;
+    }
+    while (20 - i < width) tmp[--i] = '0';
+    out_str(tmp + i, 20 - i);
+}
+
+void out_uint(uint64_t v) {
+    out_uint_pad(v, 1);
+}
+
+void out_int(int64_t v) {
+    if (v < 0) {
+        out_char('-');
+        out_uint(-(uint64_t)v);
+    } else {
+        out_uint(v);
+    }
+}
+
+void out_bool(int v) {
+    if (v) out_str("true", 4);
+    else out_str("false", 5);
+}
+
+// Same output as printf("%.*f", prec, v) for prec <= 9.
+// The value is scaled and rounded in integer arithmetic; values that are too
+// large, not finite or too close to a rounding tie go through snprintf.
+void out_double(double v, int prec) {
+    static const uint64_t pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+    double scaled = v * pow10[prec];
+    double a = scaled < 0 ? -scaled : scaled;
+    if (a < 1e12) {
+        uint64_t n = (uint64_t)a;
+        double frac = a - (double)n;
+        if (frac < 0.499 || frac > 0.501) {
+            if (frac > 0.5) n++;
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            if (bits >> 63) out_char('-');
+            out_uint(n / pow10[prec]);
+            if (prec > 0) {
+                out_char('.');
+                out_uint_pad(n % pow10[prec], prec);
+            }
+            return;
+        }
+    }
+    char tmp[512];
+    int len = snprintf(tmp, sizeof(tmp), "%.*f", prec, v);
+    out_str(tmp, len);
+}
+
+void out_date(int date) {
+    int year = date / 10000;
+
+    if (year == 0) {
+        out_int(date);
+        return;
+    }
+
+    out_uint_pad(year, 4);
+    out_char('-');
+    out_uint_pad((date / 100) % 100, 2);
+    out_char('-');
+    out_uint_pad(date % 100, 2);
+}
+
 char *strnstr(const char *s, const char *find, size_t slen) {
 	char c, sc;
 	size_t len;
@@ -148,3 +337,1409 @@ int strnstr_idx(const char *s, size_t slen, const char *find, size_t flen) {
     } while (strncmp(s, find, flen) != 0);
     return (init_length - slen - 1);
 }
+
+// Bump allocator for strings that need to outlive the buffer they were
+// read from (e.g. keys taken from an element of a streamed JSON array).
+char *str_arena_ptr = NULL;
+size_t str_arena_left = 0;
+
+const char *str_arena_copy(const char *str, int len) {
+    if ((size_t)len > str_arena_left) {
+        size_t size = len > (1 << 20) ? len : (1 << 20);
+        str_arena_ptr = malloc(size);
+        str_arena_left = size;
+    }
+    char *res = str_arena_ptr;
+    memcpy(res, str, len);
+    str_arena_ptr += len;
+    str_arena_left -= len;
+    return res;
+}
+
+// Streaming reader for files holding a single top-level JSON array.
+// Elements are handed out one at a time from a sliding buffer, so memory
+// use is bounded by the largest element instead of the file size.
+typedef struct {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    int eof;
+} json_stream;
+
+// Move the unconsumed bytes to the front of the buffer and read more data.
+// The buffer is grown if a single element does not fit.
+int json_stream_fill(json_stream *s) {
+    if (s->eof) return 0;
+    if (s->start > 0) {
+        memmove(s->buf, s->buf + s->start, s->end - s->start);
+        s->end -= s->start;
+        s->start = 0;
+    }
+    if (s->end == s->cap) {
+        s->cap *= 2;
+        s->buf = realloc(s->buf, s->cap);
+    }
+    ssize_t r = read(s->fd, s->buf + s->end, s->cap - s->end);
+    if (r <= 0) {
+        s->eof = 1;
+        return 0;
+    }
+    s->end += r;
+    return 1;
+}
+
+void json_stream_close(json_stream *s) {
+    if (s->fd < 0) return;
+    close(s->fd);
+    free(s->buf);
+    s->fd = -1;
+    s->buf = NULL;
+}
+
+int json_stream_is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Open the file and consume the opening bracket of the top-level array.
+// Returns 0 on success, -1 if the file cannot be opened or is not an array.
+int json_stream_open(json_stream *s, const char *filename, size_t cap) {
+    s->fd = open(filename, 0);
+    if (s->fd == -1) return -1;
+    s->buf = malloc(cap);
+    s->cap = cap;
+    s->start = 0;
+    s->end = 0;
+    s->eof = 0;
+    for (;;) {
+        while (s->start < s->end && json_stream_is_space(s->buf[s->start])) s->start++;
+        if (s->start < s->end) break;
+        if (!json_stream_fill(s)) break;
+    }
+    if (s->start == s->end || s->buf[s->start] != '[') {
+        json_stream_close(s);
+        return -1;
+    }
+    s->start++;
+    return 0;
+}
+
+// Find the next element of the array. On success, elem and len point to the
+// raw text of the element, which stays valid until the next call.
+// Returns 0 (and releases the stream) once the closing bracket is reached.
+int json_stream_next(json_stream *s, const char **elem, size_t *len) {
+    if (s->fd < 0) return 0;
+    for (;;) {
+        while (s->start < s->end && (json_stream_is_space(s->buf[s->start]) || s->buf[s->start] == ',')) s->start++;
+        if (s->start < s->end) break;
+        if (!json_stream_fill(s)) {
+            json_stream_close(s);
+            return 0;
+        }
+    }
+    if (s->buf[s->start] == ']') {
+        json_stream_close(s);
+        return 0;
+    }
+    size_t i = s->start;
+    int depth = 0;
+    int in_str = 0;
+    int escaped = 0;
+    for (;;) {
+        if (i == s->end) {
+            size_t off = i - s->start;
+            if (!json_stream_fill(s)) break;
+            i = s->start + off;
+            continue;
+        }
+        char c = s->buf[i];
+        if (in_str) {
+            if (escaped) escaped = 0;
+            else if (c == '\\') escaped = 1;
+            else if (c == '"') in_str = 0;
+        } else if (c == '"') {
+            in_str = 1;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            // a closing bracket at depth 0 ends the array (and a scalar element)
+            if (depth == 0) break;
+            depth--;
+            if (depth == 0) {
+                i++;
+                break;
+            }
+        } else if (c == ',' && depth == 0) {
+            break;
+        }
+        i++;
+    }
+    *elem = s->buf + s->start;
+    *len = i - s->start;
+    s->start = i;
+    return 1;
+}
+
+// Map one file of a shredded NDJSON directory (see src/cgen/shred.js).
+// Exits if the file is missing since the column layout is fixed at compile time.
+const char *map_column(const char *dir, const char *name, size_t *size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open column file %s\n", path);
+        exit(1);
+    }
+    size_t n = fsize(fd);
+    const char *res = "";
+    if (n > 0) res = mmap(0, n, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    close(fd);
+    if (res == MAP_FAILED) {
+        fprintf(stderr, "Unable to map column file %s\n", path);
+        exit(1);
+    }
+    if (size) *size = n;
+    return res;
+}
+
+// Definition bit of row i
+int def_bit(const uint8_t *def, size_t i) {
+    return (def[i >> 3] >> (i & 7)) & 1;
+}
+
+// Query parameters are passed to the compiled query as command line
+// arguments, in the order listed in func.explain.params.
+const char *param_arg(int argc, char **argv, int i, const char *name) {
+    if (i >= argc) {
+        fprintf(stderr, "Missing value for query parameter %s\n", name);
+        exit(1);
+    }
+    return argv[i];
+}
+
+void param_error(const char *name, const char *type, const char *s) {
+    fprintf(stderr, "Invalid %s value for query parameter %s: %s\n", type, name, s);
+    exit(1);
+}
+
+int64_t parse_param_int(const char *s, const char *name) {
+    char *end;
+    int64_t v = strtoll(s, &end, 10);
+    if (*s == 0 || *end != 0) param_error(name, "integer", s);
+    return v;
+}
+
+uint64_t parse_param_uint(const char *s, const char *name) {
+    char *end;
+    uint64_t v = strtoull(s, &end, 10);
+    if (*s == 0 || *s == '-' || *end != 0) param_error(name, "unsigned integer", s);
+    return v;
+}
+
+double parse_param_double(const char *s, const char *name) {
+    char *end;
+    double v = strtod(s, &end);
+    if (*s == 0 || *end != 0) param_error(name, "number", s);
+    return v;
+}
+
+int parse_param_bool(const char *s, const char *name) {
+    if (strcmp(s, "true") == 0 || strcmp(s, "1") == 0) return 1;
+    if (strcmp(s, "false") == 0 || strcmp(s, "0") == 0) return 0;
+    param_error(name, "boolean", s);
+    return 0;
+}
+
+// Dates are stored as yyyymmdd, accepts YYYY-MM-DD or the integer form
+int parse_param_date(const char *s, const char *name) {
+    int y, m, d, n;
+    if (sscanf(s, "%d-%d-%d%n", &y, &m, &d, &n) == 3 && s[n] == 0)
+        return y * 10000 + m * 100 + d;
+    return parse_param_int(s, name);
+}
+
+// First len (<= 8) bytes of str as a little-endian word, the counterpart of
+// masking the first 8 bytes of a string in the short string comparisons
+uint64_t str_word(const char *str, int len) {
+    uint64_t w = 0;
+    memcpy(&w, str, len);
+    return w;
+}
+
+uint64_t str_mask(int len) {
+    return len >= 8 ? ~0ULL : (1ULL << (8 * len)) - 1;
+}
+
+#ifdef RHYME_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// Hardware counters read at the timing points of the query (perfCounters
+// setting). When perf events cannot be opened (no permission, containers,
+// unsupported events) the affected counters read as zero and
+// perf_available reports which events were counted.
+#define PERF_NUM_EVENTS 4
+
+const char *perf_event_names[PERF_NUM_EVENTS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+uint64_t perf_event_configs[PERF_NUM_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int perf_leader = -1;
+// position of each event in the group read, -1 if it is not counted
+int perf_pos[PERF_NUM_EVENTS];
+int perf_available = 0;
+
+typedef struct {
+    uint64_t v[PERF_NUM_EVENTS];
+} perf_sample;
+
+void perf_open() {
+    int n = 0;
+    for (int i = 0; i < PERF_NUM_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_event_configs[i];
+        attr.disabled = perf_leader == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, perf_leader, 0);
+        perf_pos[i] = fd == -1 ? -1 : n++;
+        if (fd != -1 && perf_leader == -1) perf_leader = fd;
+        if (fd != -1) perf_available |= 1 << i;
+    }
+    if (perf_leader != -1) {
+        ioctl(perf_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void perf_read(perf_sample *s) {
+    uint64_t buf[PERF_NUM_EVENTS + 1] = {0};
+    if (perf_leader != -1 && read(perf_leader, buf, sizeof(buf)) <= 0) memset(buf, 0, sizeof(buf));
+    for (int i = 0; i < PERF_NUM_EVENTS; i++)
+        s->v[i] = perf_pos[i] == -1 ? 0 : buf[1 + perf_pos[i]];
+}
+
+// Counter deltas of a phase as a JSON object on stderr
+void perf_print_phase(const char *name, perf_sample *from, perf_sample *to) {
+    fprintf(stderr, ", \"%s\": {", name);
+    for (int i = 0; i < PERF_NUM_EVENTS; i++)
+        fprintf(stderr, "%s\"%s\": %lu", i > 0 ? ", " : "", perf_event_names[i], (unsigned long)(to->v[i] - from->v[i]));
+    uint64_t cycles = to->v[0] - from->v[0];
+    uint64_t instructions = to->v[1] - from->v[1];
+    fprintf(stderr, ", \"ipc\": %.3f}", cycles > 0 ? (double)instructions / cycles : 0.0);
+}
+#endif
+
+#ifdef RHYME_SERVER
+// Resident server mode: the inputs are loaded once, then one query is run
+// per line read from stdin. A line holds the query parameters separated by
+// tabs, in the order of func.explain.params.
+//
+// Allocations made while running a query come from an arena that is reset
+// after the response has been written. Memory allocated while loading the
+// inputs (before server_begin) stays resident.
+#define SERVER_ARENA_SIZE (1ULL << 36)
+#define SERVER_MAX_PARAMS 256
+
+char *server_arena = NULL;
+size_t server_arena_pos = 0;
+int server_started = 0;
+
+void *server_alloc(size_t n) {
+    if (!server_started) return malloc(n);
+    if (server_arena == NULL) {
+        // pages are only backed once touched, and fresh pages are zeroed
+        server_arena = mmap(0, SERVER_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (server_arena == MAP_FAILED) {
+            fprintf(stderr, "Unable to reserve the server arena\n");
+            exit(1);
+        }
+    }
+    size_t pos = (server_arena_pos + 15) & ~(size_t)15;
+    if (pos + n > SERVER_ARENA_SIZE) {
+        fprintf(stderr, "Server arena exhausted\n");
+        exit(1);
+    }
+    server_arena_pos = pos + n;
+    return server_arena + pos;
+}
+
+void *server_calloc(size_t n, size_t size) {
+    if (!server_started) return calloc(n, size);
+    return server_alloc(n * size);
+}
+
+void server_free(void *p) {
+    if (server_arena != NULL && (char *)p >= server_arena && (char *)p < server_arena + SERVER_ARENA_SIZE) return;
+    free(p);
+}
+
+// Release the memory of the last query. Pages are handed back to the system
+// so that they read as zero again, which keeps server_calloc correct.
+void server_arena_reset() {
+    if (server_arena == NULL) return;
+    size_t page = sysconf(_SC_PAGESIZE);
+    madvise(server_arena, (server_arena_pos + page - 1) & ~(page - 1), MADV_DONTNEED);
+    server_arena_pos = 0;
+}
+
+void server_begin() {
+    server_started = 1;
+}
+
+// Read the next request, argv[1..] point to the parameter values.
+// Returns 0 once stdin is closed.
+int server_next_request(int *argc, char ***argv) {
+    static char *line = NULL;
+    static size_t cap = 0;
+    static char *args[SERVER_MAX_PARAMS + 1];
+    ssize_t n = getline(&line, &cap, stdin);
+    if (n < 0) return 0;
+    if (n > 0 && line[n - 1] == '\n') line[--n] = 0;
+    args[0] = (*argv)[0];
+    int i = 1;
+    args[i++] = line;
+    for (char *p = line; *p; p++) {
+        if (*p == '\t' && i <= SERVER_MAX_PARAMS) {
+            *p = 0;
+            args[i++] = p + 1;
+        }
+    }
+    *argc = i;
+    *argv = args;
+    return 1;
+}
+
+// Write the end of the response and drop the state of the query
+void server_end_request() {
+    out_flush();
+    uint32_t end = 0;
+    out_write_raw((const char *)&end, sizeof(end));
+    out_flushed = 0;
+    server_arena_reset();
+}
+
+#define malloc(n) server_alloc(n)
+#define calloc(n, size) server_calloc(n, size)
+#define free(p) server_free(p)
+#endif
+
+// Monotonic time in μs for the phase timers of instrumented queries
+uint64_t instr_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#ifdef RHYME_MEMSTATS
+#include <sys/resource.h>
+
+// Registry entry of a buffer of the generated data structures, the entries
+// are declared by the generated code (mem_registry)
+typedef struct {
+    size_t reserved;
+    size_t allocations;
+} mem_entry;
+
+void *mem_track(mem_entry *entry, void *p, size_t bytes) {
+    entry->reserved += bytes;
+    entry->allocations++;
+    return p;
+}
+
+// Peak resident set size of the process in bytes
+size_t mem_peak_rss() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (size_t)usage.ru_maxrss * 1024;
+}
+#endif
+
+// Batch size and aggregation kernels of the vectorized execution mode.
+// The reductions run on a local accumulator so that the compiler can keep
+// it in (vector) registers.
+#define RHYME_VEC_SIZE 1024
+
+#define vec_sum(T, acc, vals, n) do { \
+    T vec_acc = 0; \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) vec_acc += (vals)[vec_i]; \
+    (acc) += vec_acc; \
+} while (0)
+
+#define vec_min(T, acc, vals, n) do { \
+    T vec_acc = (acc); \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) vec_acc = (vals)[vec_i] < vec_acc ? (vals)[vec_i] : vec_acc; \
+    (acc) = vec_acc; \
+} while (0)
+
+#define vec_max(T, acc, vals, n) do { \
+    T vec_acc = (acc); \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) vec_acc = (vals)[vec_i] > vec_acc ? (vals)[vec_i] : vec_acc; \
+    (acc) = vec_acc; \
+} while (0)
+
+// Selection vectors hold the positions of the rows of a batch that are still
+// selected. The selection kernels compact them in place: each position is
+// written and the count only advances if the row passes, so there is no
+// branch on the data. The comparison kernels take two typed vectors (vv) or
+// a vector and a scalar (vs), OP is a C comparison operator.
+#define vec_sel_all(sel, nsel, n) do { \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) (sel)[vec_i] = vec_i; \
+    (nsel) = (n); \
+} while (0)
+
+#define vec_sel_mask(sel, nsel, mask, n) do { \
+    size_t vec_m = 0; \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) { (sel)[vec_m] = vec_i; vec_m += (mask)[vec_i]; } \
+    (nsel) = vec_m; \
+} while (0)
+
+#define vec_sel_vv(sel, nsel, a, OP, b) do { \
+    size_t vec_m = 0; \
+    for (size_t vec_j = 0; vec_j < (nsel); vec_j++) { \
+        size_t vec_i = (sel)[vec_j]; \
+        (sel)[vec_m] = vec_i; \
+        vec_m += (a)[vec_i] OP (b)[vec_i]; \
+    } \
+    (nsel) = vec_m; \
+} while (0)
+
+#define vec_sel_vs(sel, nsel, a, OP, s) do { \
+    size_t vec_m = 0; \
+    for (size_t vec_j = 0; vec_j < (nsel); vec_j++) { \
+        size_t vec_i = (sel)[vec_j]; \
+        (sel)[vec_m] = vec_i; \
+        vec_m += (a)[vec_i] OP (s); \
+    } \
+    (nsel) = vec_m; \
+} while (0)
+
+// Arithmetic kernels over the n rows of a batch into a vector of type T,
+// with a scalar on either side (vs, sv). Rows that are not selected are
+// computed as well, which keeps the loops free of gathers.
+#define vec_arith_vv(T, out, a, OP, b, n) do { \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) (out)[vec_i] = (T)((a)[vec_i] OP (b)[vec_i]); \
+} while (0)
+
+#define vec_arith_vs(T, out, a, OP, s, n) do { \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) (out)[vec_i] = (T)((a)[vec_i] OP (s)); \
+} while (0)
+
+#define vec_arith_sv(T, out, s, OP, a, n) do { \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) (out)[vec_i] = (T)((s) OP (a)[vec_i]); \
+} while (0)
+
+#define vec_cast(T, out, a, n) do { \
+    for (size_t vec_i = 0; vec_i < (n); vec_i++) (out)[vec_i] = (T)(a)[vec_i]; \
+} while (0)
+
+// Compact the values of the selected rows for the aggregation kernels
+#define vec_gather(T, out, vals, sel, nsel) do { \
+    for (size_t vec_j = 0; vec_j < (nsel); vec_j++) (out)[vec_j] = (T)(vals)[(sel)[vec_j]]; \
+} while (0)
+
+#define vec_fill(T, out, s, n) do { \
+    for (size_t vec_j = 0; vec_j < (n); vec_j++) (out)[vec_j] = (T)(s); \
+} while (0)
+
+// Top-k selection for sorts whose result is only printed up to a limit.
+// Keeps the k smallest of the indices first .. first + n - 1 (as ordered by
+// the qsort comparator cmp) in a max-heap and sorts them into out, which
+// needs room for k entries. O(n log k) instead of a full sort.
+// Returns the number of indices kept, min(k, n).
+void topk_sift_down(int *heap, int m, int i, __compar_fn_t cmp) {
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, top = i;
+        if (l < m && cmp(&heap[l], &heap[top]) > 0) top = l;
+        if (r < m && cmp(&heap[r], &heap[top]) > 0) top = r;
+        if (top == i) return;
+        int tmp = heap[i]; heap[i] = heap[top]; heap[top] = tmp;
+        i = top;
+    }
+}
+
+int topk_sort(int *out, int k, int first, int n, __compar_fn_t cmp) {
+    int m = 0;
+    for (int idx = first; idx < first + n; idx++) {
+        if (m < k) {
+            int i = m++;
+            out[i] = idx;
+            while (i > 0 && cmp(&out[(i - 1) / 2], &out[i]) < 0) {
+                int p = (i - 1) / 2;
+                int tmp = out[i]; out[i] = out[p]; out[p] = tmp;
+                i = p;
+            }
+        } else if (m > 0 && cmp(&idx, &out[0]) < 0) {
+            out[0] = idx;
+            topk_sift_down(out, m, 0, cmp);
+        }
+    }
+    qsort(out, m, sizeof(int), cmp);
+    return m;
+}
+
+// Sort routine specialized for one compare function. The comparator is a
+// static inline function and is called directly, not through a pointer as
+// with qsort. Introsort: quicksort with a median-of-three pivot, insertion
+// sort for short ranges and heapsort when the recursion gets too deep.
+// The comparators break ties by index, so all elements are distinct.
+#define RHYME_DEFINE_SORT(name, cmp) \
+void name##_sift_down(int *a, int n, int i) { \
+    while (1) { \
+        int l = 2 * i + 1, r = l + 1, top = i; \
+        if (l < n && cmp(&a[l], &a[top]) > 0) top = l; \
+        if (r < n && cmp(&a[r], &a[top]) > 0) top = r; \
+        if (top == i) return; \
+        int tmp = a[i]; a[i] = a[top]; a[top] = tmp; \
+        i = top; \
+    } \
+} \
+void name##_intro(int *a, int n, int depth) { \
+    while (n > 16) { \
+        if (depth-- == 0) { \
+            for (int i = n / 2 - 1; i >= 0; i--) name##_sift_down(a, n, i); \
+            for (int m = n - 1; m > 0; m--) { \
+                int tmp = a[0]; a[0] = a[m]; a[m] = tmp; \
+                name##_sift_down(a, m, 0); \
+            } \
+            return; \
+        } \
+        int mid = n / 2, tmp; \
+        if (cmp(&a[mid], &a[0]) < 0) { tmp = a[mid]; a[mid] = a[0]; a[0] = tmp; } \
+        if (cmp(&a[n - 1], &a[0]) < 0) { tmp = a[n - 1]; a[n - 1] = a[0]; a[0] = tmp; } \
+        if (cmp(&a[n - 1], &a[mid]) < 0) { tmp = a[n - 1]; a[n - 1] = a[mid]; a[mid] = tmp; } \
+        int pivot = a[mid], i = -1, j = n; \
+        while (1) { \
+            do i++; while (cmp(&a[i], &pivot) < 0); \
+            do j--; while (cmp(&pivot, &a[j]) < 0); \
+            if (i >= j) break; \
+            tmp = a[i]; a[i] = a[j]; a[j] = tmp; \
+        } \
+        /* recurse into the smaller half, loop on the larger one */ \
+        if (j + 1 < n - j - 1) { \
+            name##_intro(a, j + 1, depth); \
+            a += j + 1; n -= j + 1; \
+        } else { \
+            name##_intro(a + j + 1, n - j - 1, depth); \
+            n = j + 1; \
+        } \
+    } \
+    for (int i = 1; i < n; i++) { \
+        int x = a[i], j = i; \
+        for (; j > 0 && cmp(&x, &a[j - 1]) < 0; j--) a[j] = a[j - 1]; \
+        a[j] = x; \
+    } \
+} \
+void name(int *a, int n) { \
+    int depth = 0; \
+    for (int m = n; m > 1; m >>= 1) depth += 2; \
+    name##_intro(a, n, depth); \
+} \
+/* merge of two sorted runs, used by parallel_sort */ \
+void name##_merge(int *a, int na, int *b, int nb, int *out) { \
+    int i = 0, j = 0, k = 0; \
+    while (i < na && j < nb) out[k++] = cmp(&b[j], &a[i]) < 0 ? b[j++] : a[i++]; \
+    while (i < na) out[k++] = a[i++]; \
+    while (j < nb) out[k++] = b[j++]; \
+}
+
+// Keys of the radix sort: unsigned integers that order like the values
+uint64_t radix_key_int(int64_t v) {
+    return (uint64_t)v ^ 0x8000000000000000ull;
+}
+
+uint64_t radix_key_double(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | 0x8000000000000000ull;
+}
+
+// Stable LSD radix sort of the indices idx by keys, one byte per pass.
+// Passes over bytes that are the same for all keys are skipped.
+void radix_sort(uint64_t *keys, int *idx, int n) {
+    if (n < 2) return;
+    size_t counts[8][256] = { 0 };
+    for (int i = 0; i < n; i++) {
+        for (int b = 0; b < 8; b++) counts[b][(keys[i] >> (8 * b)) & 0xff]++;
+    }
+    uint64_t *keys1 = (uint64_t *)malloc(sizeof(uint64_t) * n);
+    int *idx1 = (int *)malloc(sizeof(int) * n);
+    uint64_t *src_keys = keys, *dst_keys = keys1;
+    int *src_idx = idx, *dst_idx = idx1;
+    for (int b = 0; b < 8; b++) {
+        if (counts[b][(keys[0] >> (8 * b)) & 0xff] == (size_t)n) continue;
+        size_t pos = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t c = counts[b][d];
+            counts[b][d] = pos;
+            pos += c;
+        }
+        for (int i = 0; i < n; i++) {
+            size_t p = counts[b][(src_keys[i] >> (8 * b)) & 0xff]++;
+            dst_keys[p] = src_keys[i];
+            dst_idx[p] = src_idx[i];
+        }
+        uint64_t *tk = src_keys; src_keys = dst_keys; dst_keys = tk;
+        int *ti = src_idx; src_idx = dst_idx; dst_idx = ti;
+    }
+    if (src_idx != idx) memcpy(idx, src_idx, sizeof(int) * n);
+    free(keys1);
+    free(idx1);
+}
+
+// Normalized sort keys: fixed-width byte strings whose memcmp order is the
+// sort order. Values are stored big-endian, descending columns inverted.
+void sortkey_put_u64(unsigned char *p, uint64_t v, int desc) {
+    if (desc) v = ~v;
+    for (int b = 7; b >= 0; b--, v >>= 8) p[b] = (unsigned char)v;
+}
+
+// Prefix of width bytes, zero-padded (shorter strings order first)
+void sortkey_put_str(unsigned char *p, const char *s, int len, int width, int desc) {
+    int n = len < width ? len : width;
+    memcpy(p, s, n);
+    memset(p + n, 0, width - n);
+    if (desc) {
+        for (int b = 0; b < width; b++) p[b] = ~p[b];
+    }
+}
+
+#ifdef RHYME_PARALLEL_SORT
+#include <pthread.h>
+
+// Run f(arg, 0) .. f(arg, n - 1) on n threads (one of them the caller's).
+// The worker threads are started on first use and kept waiting for the next
+// call, a call with more tasks than threads starts more of them (up to
+// PAR_MAX_THREADS). Tasks are claimed from a shared counter, so a call with
+// fewer tasks, e.g. a late merge round, leaves the other workers idle.
+#define PAR_MAX_THREADS 64
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    int workers;
+    unsigned long job;
+    void (*f)(void *, int);
+    void *arg;
+    int n, next, pending;
+} par_pool;
+
+par_pool par_state = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, NULL, NULL, 0, 0, 0 };
+
+// Claim and run tasks of the current job until none is left, with the lock
+// held on entry and exit
+void par_run_tasks(void) {
+    while (par_state.next < par_state.n) {
+        int t = par_state.next++;
+        void (*f)(void *, int) = par_state.f;
+        void *arg = par_state.arg;
+        pthread_mutex_unlock(&par_state.lock);
+        f(arg, t);
+        pthread_mutex_lock(&par_state.lock);
+        if (--par_state.pending == 0) pthread_cond_signal(&par_state.done);
+    }
+}
+
+void *par_worker(void *p) {
+    (void)p;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&par_state.lock);
+    for (;;) {
+        while (par_state.job == seen) pthread_cond_wait(&par_state.start, &par_state.lock);
+        seen = par_state.job;
+        par_run_tasks();
+    }
+    return NULL;
+}
+
+void parallel_for(int n, void (*f)(void *, int), void *arg) {
+    pthread_mutex_lock(&par_state.lock);
+    while (par_state.workers < n - 1 && par_state.workers < PAR_MAX_THREADS - 1) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, par_worker, NULL) != 0) break;
+        pthread_detach(thread);
+        par_state.workers++;
+    }
+    par_state.f = f;
+    par_state.arg = arg;
+    par_state.n = n;
+    par_state.next = 0;
+    par_state.pending = n;
+    par_state.job++;
+    pthread_cond_broadcast(&par_state.start);
+    par_run_tasks();
+    while (par_state.pending > 0) pthread_cond_wait(&par_state.done, &par_state.lock);
+    pthread_mutex_unlock(&par_state.lock);
+}
+
+// Parallel merge sort: each thread sorts one chunk with the specialized
+// sort routine, then the sorted runs are merged pairwise, the merges of a
+// round running in parallel. Arrays shorter than threshold are sorted on
+// the calling thread.
+typedef struct {
+    int *src, *dst;
+    int *bounds;
+    int threads, width;
+    void (*sort)(int *, int);
+    void (*merge)(int *, int, int *, int, int *);
+} psort_state;
+
+void psort_sort_chunk(void *arg, int t) {
+    psort_state *s = (psort_state *)arg;
+    s->sort(s->src + s->bounds[t], s->bounds[t + 1] - s->bounds[t]);
+}
+
+void psort_merge_runs(void *arg, int k) {
+    psort_state *s = (psort_state *)arg;
+    int t = 2 * k * s->width;
+    int mid = t + s->width < s->threads ? t + s->width : s->threads;
+    int end = t + 2 * s->width < s->threads ? t + 2 * s->width : s->threads;
+    int lo = s->bounds[t], m = s->bounds[mid], hi = s->bounds[end];
+    s->merge(s->src + lo, m - lo, s->src + m, hi - m, s->dst + lo);
+}
+
+void parallel_sort(int *a, int n, int threads, int threshold,
+                   void (*sort)(int *, int), void (*merge)(int *, int, int *, int, int *)) {
+    if (threads < 2 || n < threshold) {
+        sort(a, n);
+        return;
+    }
+    int bounds[threads + 1];
+    for (int t = 0; t <= threads; t++) bounds[t] = (int)((int64_t)n * t / threads);
+    int *tmp = (int *)malloc(sizeof(int) * n);
+    psort_state s = { a, tmp, bounds, threads, 1, sort, merge };
+    parallel_for(threads, psort_sort_chunk, &s);
+    for (; s.width < threads; s.width *= 2) {
+        parallel_for((threads + 2 * s.width - 1) / (2 * s.width), psort_merge_runs, &s);
+        int *swap = s.src; s.src = s.dst; s.dst = swap;
+    }
+    if (s.src != a) memcpy(a, s.src, sizeof(int) * n);
+    free(tmp);
+}
+#endif
+
+// External sort for sorts with a memory budget (settings.sortMemory).
+// Each entry is added as a record of its fixed-width sort key followed by
+// its index. Runs of records that fit the budget are sorted with cmp (on
+// records) and written to temporary files. sort_merge_next then k-way merges
+// the runs through a heap of the run heads, one entry per call, so that the
+// sorted order streams into the print loop. If all records fit the budget
+// nothing is spilled and the buffer is read in order.
+typedef struct {
+    FILE *file;
+    int64_t left;
+    unsigned char *head;
+} sort_run;
+
+typedef struct {
+    size_t rec_size;
+    int64_t run_len, len, pos;
+    unsigned char *buf;
+    __compar_fn_t cmp;
+    int num_runs, m;
+    sort_run *runs;
+    unsigned char *heads;
+    sort_run **heap;
+} sort_merge;
+
+void sort_merge_init(sort_merge *s, int n, size_t key_size, size_t budget, __compar_fn_t cmp) {
+    memset(s, 0, sizeof(sort_merge));
+    s->rec_size = key_size + sizeof(int);
+    s->run_len = budget / s->rec_size;
+    if (s->run_len > n) s->run_len = n;
+    if (s->run_len < 1) s->run_len = 1;
+    s->buf = (unsigned char *)malloc(s->rec_size * s->run_len);
+    s->cmp = cmp;
+    // a run per run_len entries
+    s->runs = (sort_run *)malloc(sizeof(sort_run) * ((n + s->run_len - 1) / s->run_len));
+}
+
+void sort_merge_spill(sort_merge *s) {
+    qsort(s->buf, s->len, s->rec_size, s->cmp);
+    sort_run *run = &s->runs[s->num_runs++];
+    run->file = tmpfile();
+    if (run->file == NULL || fwrite(s->buf, s->rec_size, s->len, run->file) != (size_t)s->len) {
+        perror("sort_merge: spill");
+        exit(1);
+    }
+    rewind(run->file);
+    run->left = s->len;
+    s->len = 0;
+}
+
+// Record of the entry at idx, the caller writes the sort key to the start
+unsigned char *sort_merge_add(sort_merge *s, int idx) {
+    if (s->len == s->run_len) sort_merge_spill(s);
+    unsigned char *rec = s->buf + s->rec_size * s->len++;
+    memcpy(rec + s->rec_size - sizeof(int), &idx, sizeof(int));
+    return rec;
+}
+
+int sort_merge_idx(sort_merge *s, const unsigned char *rec) {
+    int idx;
+    memcpy(&idx, rec + s->rec_size - sizeof(int), sizeof(int));
+    return idx;
+}
+
+// Read the next head of the run, closes the run at its end
+int sort_run_read(sort_merge *s, sort_run *run) {
+    if (run->left == 0) {
+        fclose(run->file);
+        run->file = NULL;
+        return 0;
+    }
+    if (fread(run->head, s->rec_size, 1, run->file) != 1) {
+        perror("sort_merge: read");
+        exit(1);
+    }
+    run->left--;
+    return 1;
+}
+
+void sort_runs_sift_down(sort_merge *s, int i) {
+    sort_run **heap = s->heap;
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, top = i;
+        if (l < s->m && s->cmp(heap[l]->head, heap[top]->head) < 0) top = l;
+        if (r < s->m && s->cmp(heap[r]->head, heap[top]->head) < 0) top = r;
+        if (top == i) return;
+        sort_run *tmp = heap[i]; heap[i] = heap[top]; heap[top] = tmp;
+        i = top;
+    }
+}
+
+void sort_merge_finish(sort_merge *s) {
+    if (s->num_runs == 0) {
+        qsort(s->buf, s->len, s->rec_size, s->cmp);
+        return;
+    }
+    if (s->len > 0) sort_merge_spill(s);
+    free(s->buf);
+    s->buf = NULL;
+    s->heads = (unsigned char *)malloc(s->rec_size * s->num_runs);
+    s->heap = (sort_run **)malloc(sizeof(sort_run *) * s->num_runs);
+    for (int r = 0; r < s->num_runs; r++) {
+        s->runs[r].head = s->heads + s->rec_size * r;
+        if (sort_run_read(s, &s->runs[r])) s->heap[s->m++] = &s->runs[r];
+    }
+    for (int i = s->m / 2 - 1; i >= 0; i--) sort_runs_sift_down(s, i);
+}
+
+// Index of the next entry in sorted order
+int sort_merge_next(sort_merge *s) {
+    if (s->num_runs == 0) return sort_merge_idx(s, s->buf + s->rec_size * s->pos++);
+    sort_run *run = s->heap[0];
+    int idx = sort_merge_idx(s, run->head);
+    if (!sort_run_read(s, run)) s->heap[0] = s->heap[--s->m];
+    sort_runs_sift_down(s, 0);
+    return idx;
+}
+
+// Close the runs that were not read to the end and release the buffers
+void sort_merge_free(sort_merge *s) {
+    for (int r = 0; r < s->num_runs; r++) {
+        if (s->runs[r].file) fclose(s->runs[r].file);
+    }
+    free(s->buf);
+    free(s->runs);
+    free(s->heads);
+    free(s->heap);
+    memset(s, 0, sizeof(sort_merge));
+}
+
+// The sorted indices as an array, for sorts that are not streamed
+int *sort_merge_all(sort_merge *s, int n) {
+    int *a = (int *)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++) a[i] = sort_merge_next(s);
+    sort_merge_free(s);
+    return a;
+}
+
+// Mix of a key hash, the partitions of a spilling aggregation or a radix
+// join are taken from its bits
+uint64_t spill_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Partitions of a radix-partitioned join (settings.radixJoin). The first pass
+// scans both inputs once and appends the key hash and position of each row to
+// the bucket of its partition, the low bits of the mixed hash. Each later
+// pass builds and probes one partition from the rows of its two buckets. A
+// partition whose build side does not fit is split into two partitions of
+// one more bit by the hashes in its buckets, no input is scanned again.
+typedef struct {
+    uint64_t hash;
+    size_t row, offset;
+} radix_row;
+
+typedef struct {
+    radix_row *rows;
+    size_t len, cap;
+} radix_bucket;
+
+// buckets of the build (0) and probe (1) side
+typedef struct {
+    uint64_t part;
+    int bits;
+    radix_bucket side[2];
+} radix_part;
+
+typedef struct {
+    // partitions still to join, the last one first
+    radix_part *stack;
+    int top, cap;
+    radix_part cur;
+    int bits;
+    int partitioning;
+    int passes;
+} radix_parts;
+
+void radix_bucket_add(radix_bucket *b, uint64_t hash, size_t row, size_t offset) {
+    if (b->len == b->cap) {
+        b->cap = b->cap ? 2 * b->cap : 256;
+        b->rows = (radix_row *)realloc(b->rows, sizeof(radix_row) * b->cap);
+    }
+    b->rows[b->len].hash = hash;
+    b->rows[b->len].row = row;
+    b->rows[b->len++].offset = offset;
+}
+
+void radix_push(radix_parts *r, uint64_t part, int bits) {
+    if (r->top == r->cap) {
+        r->cap = r->cap ? 2 * r->cap : 64;
+        r->stack = (radix_part *)realloc(r->stack, sizeof(radix_part) * r->cap);
+    }
+    memset(&r->stack[r->top], 0, sizeof(radix_part));
+    r->stack[r->top].part = part;
+    r->stack[r->top++].bits = bits;
+}
+
+void radix_init(radix_parts *r, int bits) {
+    memset(r, 0, sizeof(radix_parts));
+    r->bits = bits;
+    for (int i = (1 << bits) - 1; i >= 0; i--) radix_push(r, i, bits);
+}
+
+// Row of a side in the first pass, partition i is at stack[2^bits - 1 - i]
+void radix_add(radix_parts *r, int side, uint64_t hash, size_t row, size_t offset) {
+    uint64_t part = spill_mix(hash) & ((1ull << r->bits) - 1);
+    radix_bucket_add(&r->stack[(1 << r->bits) - 1 - part].side[side], hash, row, offset);
+}
+
+void radix_free_part(radix_part *p) {
+    free(p->side[0].rows);
+    free(p->side[1].rows);
+    memset(p->side, 0, sizeof(p->side));
+}
+
+// Start the next pass: the first one partitions the inputs, each following
+// one joins a partition. Returns 0 once all partitions are joined.
+int radix_next(radix_parts *r) {
+    if (r->passes++ == 0) {
+        r->partitioning = 1;
+        return 1;
+    }
+    r->partitioning = 0;
+    radix_free_part(&r->cur);
+    if (r->top == 0) return 0;
+    r->cur = r->stack[--r->top];
+    return 1;
+}
+
+// The build side of the current partition does not fit
+void radix_split(radix_parts *r) {
+    radix_part *p = &r->cur;
+    if (p->bits == 64) {
+        fprintf(stderr, "groups of a single hash do not fit the memory budget\n");
+        exit(1);
+    }
+    radix_push(r, p->part | (1ull << p->bits), p->bits + 1);
+    radix_push(r, p->part, p->bits + 1);
+    for (int s = 0; s < 2; s++) {
+        radix_bucket *b = &p->side[s];
+        for (size_t i = 0; i < b->len; i++) {
+            radix_row *e = &b->rows[i];
+            int hi = (spill_mix(e->hash) >> p->bits) & 1;
+            radix_bucket_add(&r->stack[r->top - 1 - hi].side[s], e->hash, e->row, e->offset);
+        }
+    }
+}
+
+void radix_free(radix_parts *r) {
+    radix_free_part(&r->cur);
+    for (int i = 0; i < r->top; i++) radix_free_part(&r->stack[i]);
+    free(r->stack);
+}
+
+// Partial aggregates of a spilling aggregation (settings.groupMemory). When
+// the groups of the top-level group-by exceed the budget, each group is
+// appended to one of SPILL_FANOUT temporary files by the next SPILL_BITS bits
+// of its mixed hash and the table is emptied, so the input is scanned once.
+// Each file is then merged on its own, a file whose groups do not fit either
+// is spilled again into partitions of the following bits. Records are the
+// keys and values of a group (strings as length and bytes), see spill_read.
+#define SPILL_BITS 4
+#define SPILL_FANOUT (1 << SPILL_BITS)
+#define SPILL_MAX_DEPTH (64 / SPILL_BITS)
+
+typedef struct {
+    FILE *file;
+    int depth;
+} spill_source;
+
+typedef struct {
+    FILE *out[SPILL_FANOUT];
+    int depth;
+    int flushed;
+    // files still to merge, the last one first
+    spill_source stack[SPILL_FANOUT * (SPILL_MAX_DEPTH + 1)];
+    int top;
+    // the file being merged
+    char *data;
+    size_t size, pos;
+    long printed;
+} spill_groups;
+
+void spill_init(spill_groups *s) {
+    memset(s, 0, sizeof(spill_groups));
+}
+
+// File of the partition of a group of the current source
+FILE *spill_file(spill_groups *s, uint64_t hash) {
+    if (s->depth == SPILL_MAX_DEPTH) {
+        fprintf(stderr, "groups of a single hash do not fit the memory budget\n");
+        exit(1);
+    }
+    int part = (spill_mix(hash) >> (s->depth * SPILL_BITS)) & (SPILL_FANOUT - 1);
+    if (!s->out[part]) {
+        s->out[part] = tmpfile();
+        if (!s->out[part]) {
+            perror("spill_file");
+            exit(1);
+        }
+    }
+    s->flushed = 1;
+    return s->out[part];
+}
+
+void spill_write_str(FILE *f, const char *str, int len) {
+    fwrite(&len, sizeof(int), 1, f);
+    fwrite(str, 1, len, f);
+}
+
+void spill_read(spill_groups *s, void *dst, size_t size) {
+    memcpy(dst, s->data + s->pos, size);
+    s->pos += size;
+}
+
+// The string stays in the mapping until the next source
+const char *spill_read_str(spill_groups *s, int *len) {
+    spill_read(s, len, sizeof(int));
+    const char *str = s->data + s->pos;
+    s->pos += *len;
+    return str;
+}
+
+// The groups of the current source are printed or spilled: queue the files
+// it spilled to and map the next file. Returns 0 once all files are merged.
+int spill_next(spill_groups *s) {
+    if (s->data) munmap(s->data, s->size);
+    s->data = NULL;
+    for (int i = SPILL_FANOUT - 1; i >= 0; i--) {
+        if (!s->out[i]) continue;
+        s->stack[s->top].file = s->out[i];
+        s->stack[s->top++].depth = s->depth + 1;
+        s->out[i] = NULL;
+    }
+    if (s->top == 0) return 0;
+    spill_source src = s->stack[--s->top];
+    fflush(src.file);
+    int fd = fileno(src.file);
+    s->size = fsize(fd);
+    s->data = mmap(0, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (s->data == MAP_FAILED) {
+        perror("spill_next");
+        exit(1);
+    }
+    // the mapping outlives the file, which is removed on close
+    fclose(src.file);
+    s->pos = 0;
+    s->depth = src.depth;
+    s->flushed = 0;
+    return 1;
+}
+
+// (group, value) pairs seen by a count-distinct (countDistinct), one set per
+// op for all of its groups. The group is the address of its counter, numbers
+// are stored by their radix key, strings by reference and their hash. The
+// table doubles when half full, so it grows with the distinct pairs only.
+typedef struct {
+    const void *group;
+    uint64_t value;
+    const char *str;
+    int len;
+} distinct_entry;
+
+typedef struct {
+    distinct_entry *entries;
+    size_t capacity, count;
+} distinct_set;
+
+uint64_t distinct_hash(const void *group, uint64_t value) {
+    return spill_mix((uint64_t)(uintptr_t)group * 31 + value);
+}
+
+void distinct_grow(distinct_set *s) {
+    size_t capacity = s->capacity ? 2 * s->capacity : 1024;
+    distinct_entry *entries = calloc(capacity, sizeof(distinct_entry));
+    for (size_t i = 0; i < s->capacity; i++) {
+        distinct_entry *e = &s->entries[i];
+        if (!e->group) continue;
+        size_t pos = distinct_hash(e->group, e->value) & (capacity - 1);
+        while (entries[pos].group) pos = (pos + 1) & (capacity - 1);
+        entries[pos] = *e;
+    }
+    free(s->entries);
+    s->entries = entries;
+    s->capacity = capacity;
+}
+
+// Add the pair, returns 1 if it is new. str is NULL for numbers, transient
+// strings (copy) are copied to the string arena when added.
+int distinct_add(distinct_set *s, const void *group, uint64_t value, const char *str, int len, int copy) {
+    if (2 * (s->count + 1) > s->capacity) distinct_grow(s);
+    size_t mask = s->capacity - 1;
+    size_t pos = distinct_hash(group, value) & mask;
+    distinct_entry *e;
+    while ((e = &s->entries[pos])->group) {
+        if (e->group == group && e->value == value &&
+            (!str || (e->len == len && memcmp(e->str, str, len) == 0))) return 0;
+        pos = (pos + 1) & mask;
+    }
+    e->group = group;
+    e->value = value;
+    e->str = str && copy ? str_arena_copy(str, len) : str;
+    e->len = len;
+    s->count++;
+    return 1;
+}
+
+void distinct_free(distinct_set *s) {
+    free(s->entries);
+    s->entries = NULL;
+    s->capacity = s->count = 0;
+}
+
+#ifdef RHYME_SKETCH
+#include <math.h>
+
+// Sketches of approximate aggregates (approxCountDistinct, approxQuantile,
+// median), one per group. The sketches of an op are kept by the address of
+// the group's result, the results are written when the loops are done.
+typedef struct {
+    const void *group;
+    void *state;
+} sketch_entry;
+
+typedef struct {
+    sketch_entry *entries;
+    size_t capacity, count;
+} sketch_map;
+
+// Slot of the group's sketch, NULL if it has none yet
+void **sketch_slot(sketch_map *m, const void *group) {
+    if (2 * (m->count + 1) > m->capacity) {
+        size_t capacity = m->capacity ? 2 * m->capacity : 64;
+        sketch_entry *entries = calloc(capacity, sizeof(sketch_entry));
+        for (size_t i = 0; i < m->capacity; i++) {
+            sketch_entry *e = &m->entries[i];
+            if (!e->group) continue;
+            size_t pos = spill_mix((uint64_t)(uintptr_t)e->group) & (capacity - 1);
+            while (entries[pos].group) pos = (pos + 1) & (capacity - 1);
+            entries[pos] = *e;
+        }
+        free(m->entries);
+        m->entries = entries;
+        m->capacity = capacity;
+    }
+    size_t mask = m->capacity - 1;
+    size_t pos = spill_mix((uint64_t)(uintptr_t)group) & mask;
+    while (m->entries[pos].group && m->entries[pos].group != group) pos = (pos + 1) & mask;
+    if (!m->entries[pos].group) {
+        m->entries[pos].group = group;
+        m->count++;
+    }
+    return &m->entries[pos].state;
+}
+
+void sketch_free(sketch_map *m) {
+    for (size_t i = 0; i < m->capacity; i++) free(m->entries[i].state);
+    free(m->entries);
+    m->entries = NULL;
+    m->capacity = m->count = 0;
+}
+
+// HyperLogLog with 2^p registers. Values are added by a 64-bit hash,
+// sketches of the same precision merge by the maximum of their registers.
+typedef struct {
+    int p;
+    uint8_t registers[];
+} hll_sketch;
+
+hll_sketch *sketch_hll(sketch_map *m, const void *group, int p) {
+    void **slot = sketch_slot(m, group);
+    if (!*slot) {
+        hll_sketch *s = calloc(1, sizeof(hll_sketch) + ((size_t)1 << p));
+        s->p = p;
+        *slot = s;
+    }
+    return *slot;
+}
+
+void hll_add(hll_sketch *s, uint64_t value) {
+    uint64_t h = spill_mix(value);
+    size_t idx = h >> (64 - s->p);
+    uint64_t rest = h << s->p;
+    int rank = rest ? __builtin_clzll(rest) + 1 : 64 - s->p + 1;
+    if (rank > s->registers[idx]) s->registers[idx] = rank;
+}
+
+void hll_merge(hll_sketch *s, const hll_sketch *other) {
+    for (size_t i = 0; i < ((size_t)1 << s->p); i++)
+        if (other->registers[i] > s->registers[i]) s->registers[i] = other->registers[i];
+}
+
+double hll_estimate(const hll_sketch *s) {
+    double m = (double)((size_t)1 << s->p);
+    double sum = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < ((size_t)1 << s->p); i++) {
+        sum += 1.0 / ((uint64_t)1 << s->registers[i]);
+        if (s->registers[i] == 0) zeros++;
+    }
+    double est = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // small cardinalities: linear counting
+    if (est <= 2.5 * m && zeros > 0) est = m * log(m / zeros);
+    return est;
+}
+
+void hll_finish(sketch_map *m) {
+    for (size_t i = 0; i < m->capacity; i++) {
+        sketch_entry *e = &m->entries[i];
+        if (e->group) *(uint32_t *)e->group = (uint32_t)(hll_estimate(e->state) + 0.5);
+    }
+}
+
+// Merging t-digest (Dunning) with the arcsine scale function. Values are
+// buffered and merged into at most ~compression centroids when the buffer
+// is full, digests merge by adding the centroids of one to the other.
+#define TDIGEST_COMPRESSION 100
+#define TDIGEST_CAPACITY (6 * TDIGEST_COMPRESSION)
+
+typedef struct {
+    double mean, weight;
+} tdigest_centroid;
+
+typedef struct {
+    int merged, n;
+    double total, min, max;
+    tdigest_centroid c[TDIGEST_CAPACITY];
+} tdigest;
+
+tdigest *sketch_tdigest(sketch_map *m, const void *group) {
+    void **slot = sketch_slot(m, group);
+    if (!*slot) {
+        tdigest *t = calloc(1, sizeof(tdigest));
+        t->min = INFINITY;
+        t->max = -INFINITY;
+        *slot = t;
+    }
+    return *slot;
+}
+
+int tdigest_compare(const void *a, const void *b) {
+    double x = ((const tdigest_centroid *)a)->mean, y = ((const tdigest_centroid *)b)->mean;
+    return (x > y) - (x < y);
+}
+
+double tdigest_scale(double q) {
+    return TDIGEST_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+void tdigest_compress(tdigest *t) {
+    if (t->merged == t->n) return;
+    qsort(t->c, t->n, sizeof(tdigest_centroid), tdigest_compare);
+    int out = 0;
+    double before = 0;
+    for (int i = 1; i < t->n; i++) {
+        tdigest_centroid *cur = &t->c[out];
+        double weight = cur->weight + t->c[i].weight;
+        if (tdigest_scale((before + weight) / t->total) - tdigest_scale(before / t->total) <= 1) {
+            cur->mean += (t->c[i].mean - cur->mean) * t->c[i].weight / weight;
+            cur->weight = weight;
+        } else {
+            before += cur->weight;
+            t->c[++out] = t->c[i];
+        }
+    }
+    t->n = t->merged = out + 1;
+}
+
+void tdigest_add_weighted(tdigest *t, double x, double weight) {
+    if (t->n == TDIGEST_CAPACITY) tdigest_compress(t);
+    t->c[t->n++] = (tdigest_centroid){ x, weight };
+    t->total += weight;
+    if (x < t->min) t->min = x;
+    if (x > t->max) t->max = x;
+}
+
+void tdigest_add(tdigest *t, double x) {
+    tdigest_add_weighted(t, x, 1);
+}
+
+void tdigest_merge(tdigest *t, const tdigest *other) {
+    for (int i = 0; i < other->n; i++) tdigest_add_weighted(t, other->c[i].mean, other->c[i].weight);
+    if (other->min < t->min) t->min = other->min;
+    if (other->max > t->max) t->max = other->max;
+}
+
+// Interpolates between the centers of the centroids, and the extremes
+double tdigest_quantile(tdigest *t, double q) {
+    tdigest_compress(t);
+    if (t->n == 0) return NAN;
+    if (t->n == 1) return t->c[0].mean;
+    double target = q * t->total;
+    tdigest_centroid *first = &t->c[0], *last = &t->c[t->n - 1];
+    if (target <= first->weight / 2)
+        return t->min + (first->mean - t->min) * target / (first->weight / 2);
+    double before = 0;
+    for (int i = 0; i < t->n - 1; i++) {
+        double left = before + t->c[i].weight / 2;
+        double right = before + t->c[i].weight + t->c[i + 1].weight / 2;
+        if (target <= right)
+            return t->c[i].mean + (t->c[i + 1].mean - t->c[i].mean) * (target - left) / (right - left);
+        before += t->c[i].weight;
+    }
+    double left = t->total - last->weight / 2;
+    return last->mean + (t->max - last->mean) * (target - left) / (last->weight / 2);
+}
+
+void tdigest_finish(sketch_map *m, double q) {
+    for (size_t i = 0; i < m->capacity; i++) {
+        sketch_entry *e = &m->entries[i];
+        if (e->group) *(double *)e->group = tdigest_quantile(e->state, q);
+    }
+}
+#endif
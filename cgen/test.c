@@ -0,0 +1,11 @@
+#include <stdio.h>
+#include "rhyme.h"
+int main() {
+    rh inp = 0; // input?
+    rh tmp = rt_const_obj();
+    // --- tmp0 ---
+    // XXX NOT IMPLEMENTED
+    // --- res ---
+    rh res = rt_pure_convert_i16(rt_get(tmp, rt_const_int(0)));
+    write_result(res);
+}
\ No newline at end of file
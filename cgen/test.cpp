@@ -0,0 +1,11 @@
+#include "rhyme.hpp"
+int main() {
+    CSVector<int, int> vec1 = read_1D_sparse_tensor<int, int>("cgen/vec1.json");
+    CSVector<int, int> vec2 = read_1D_sparse_tensor<int, int>("cgen/vec2.json");
+    int tmp0 = 0;
+    for (auto xi_mit = CSVector<int, int>::multi_iterator({&vec1,&vec2});!xi_mit.finish(); ++xi_mit) {
+        tmp0 += (int)(((*xi_mit).second[0] * (*xi_mit).second[1]));
+    }
+    int res = tmp0;
+    write_result(res);
+}
\ No newline at end of file
@@ -0,0 +1,330 @@
+const { c, utils } = require("./utils")
+const { TAG } = require("./value")
+const { array, hashmap } = require("./collections")
+const { symbol } = require("./symbol")
+
+const { tmpSym } = utils
+
+const { typing, typeSyms } = require("../typing")
+
+// Binary result format (settings.format == "binary")
+//
+// The result is written to stdout as "RHYMEBIN" followed by the top-level
+// value encoded as a column of length 1. A column of n values is:
+//   validity   n x u8 (only if the values can be undefined)
+//   primitive  n fixed-width values, 8-byte aligned
+//   string     n + 1 u64 offsets (8-byte aligned) followed by the bytes
+//   json       n x (u64 length + serialized text)
+//   object     one column per field
+//   map/array  for every defined value: u64 count (8-byte aligned),
+//              key columns (maps only) and the value column
+//
+// The layout is described by a JSON descriptor computed at compile time:
+//   { kind: "prim", type, nullable }
+//   { kind: "string" | "json", nullable }
+//   { kind: "object", fields: [[name, layout], ...], nullable }
+//   { kind: "map", keys: [layout, ...], value: layout, nullable }
+//   { kind: "array", value: layout, nullable }
+
+const MAGIC = "RHYMEBIN"
+
+let outRaw = (buf, type, val) => c.stmt(buf)(c.call("out_raw", type, val))
+let outAlign = (buf) => c.stmt(buf)(c.call("out_align", "8"))
+
+// The existing value representation carries undefined entries of collections
+// as a separate "defined" flag
+let withDefinedCond = (v) => {
+  if (v.tag == TAG.OBJECT) {
+    for (let name in v.val) withDefinedCond(v.val[name])
+  }
+  if (v.defined) v.cond = c.not(v.defined)
+  return v
+}
+
+let getLimit = (count, settings) => settings.limit ? c.ternary(c.lt(settings.limit, count), settings.limit, count) : count
+
+// An iteration over the entries of a collection:
+// { count, keys, entry, loop(buf, body) }, keys and entry reference the loop variables
+let getIteration = (v, settings) => {
+  if (v.tag == TAG.HASHMAP || v.tag == TAG.NESTED_HASHMAP) {
+    let i = symbol.getSymbol("i")
+    let keyPos = symbol.getSymbol("key_pos")
+    let count = v.tag == TAG.HASHMAP ? getLimit(v.val.count, settings) : v.val.count
+    let key = hashmap.getHashMapKeyEntry(v, keyPos)
+    let keys = key.tag == TAG.COMBINED_KEY ? key.val.keys : [key]
+    let entry = withDefinedCond(array.getValueAtIdx(v, keyPos))
+    let loop = (buf, body) => {
+      buf.push(`for (int ${i} = 0; ${i} < ${count}; ${i}++) {`)
+      c.declareInt(buf)(keyPos, v.val.sorted ? `${tmpSym(v.val.sym)}[${i}]` : c.add(i, "1"))
+      body(buf)
+      buf.push(`}`)
+    }
+    return { count, keys, entry, loop }
+  } else if (v.tag == TAG.ARRAY || v.tag == TAG.HASHMAP_BUCKET) {
+    let i = symbol.getSymbol("i")
+    let idx = symbol.getSymbol("idx")
+    let count = v.tag == TAG.ARRAY ? getLimit(v.val.count, settings) : v.val.bucketCount
+    let entry = withDefinedCond(array.getValueAtIdx(v, idx))
+    let loop = (buf, body) => {
+      buf.push(`for (int ${i} = 0; ${i} < ${count}; ${i}++) {`)
+      c.declareInt(buf)(idx, v.val.sorted ? `${v.val.sym}[${i}]` : i)
+      body(buf)
+      buf.push(`}`)
+    }
+    return { count, entry, loop }
+  } else if (v.tag == TAG.HASHMAP_LINKED_BUCKET) {
+    let idx = symbol.getSymbol("idx")
+    let entry = withDefinedCond(array.getValueAtIdx(v, idx))
+    let loop = (buf, body) => {
+      buf.push(`for (int ${idx} = ${v.val.head}; ${idx} != 0; ${idx} = ${v.val.prev}[${idx}]) {`)
+      body(buf)
+      buf.push(`}`)
+    }
+    return { entry, loop }
+  }
+  throw new Error("Cannot iterate over value: " + v.tag)
+}
+
+let isCollection = (v) => v.tag == TAG.HASHMAP || v.tag == TAG.NESTED_HASHMAP || v.tag == TAG.ARRAY ||
+  v.tag == TAG.HASHMAP_BUCKET || v.tag == TAG.HASHMAP_LINKED_BUCKET
+
+// Write a single collection value, returns its layout
+let emitCollection = (buf, v, settings) => {
+  let iter = getIteration(v, settings)
+  let count = iter.count
+  if (count === undefined) {
+    count = symbol.getSymbol("count")
+    c.declareSize(buf)(count, "0")
+    iter.loop(buf, buf1 => c.stmt(buf1)(c.inc(count)))
+  }
+  outAlign(buf)
+  outRaw(buf, "uint64_t", count)
+  if (iter.keys) {
+    let keys = iter.keys.map(key => emitColumn(buf, key, iter.loop, settings))
+    let value = emitColumn(buf, iter.entry, iter.loop, settings)
+    return { kind: "map", keys, value }
+  }
+  return { kind: "array", value: emitColumn(buf, iter.entry, iter.loop, settings) }
+}
+
+// Write the column of values v for every iteration of loop, returns its layout
+let emitColumn = (buf, v, loop, settings) => {
+  let nullable = v.cond !== undefined
+  if (nullable) {
+    loop(buf, buf1 => outRaw(buf1, "uint8_t", c.not(`(${v.cond})`)))
+  }
+  let layout
+  if (isCollection(v)) {
+    // Collections are only written for defined values
+    let res
+    loop(buf, buf1 => {
+      if (nullable) buf1.push(`if (!(${v.cond})) {`)
+      res = emitCollection(buf1, v, settings)
+      if (nullable) buf1.push(`}`)
+    })
+    layout = res
+  } else if (v.tag == TAG.OBJECT) {
+    let fields = []
+    for (let name in v.val) {
+      fields.push([name, emitColumn(buf, v.val[name], loop, settings)])
+    }
+    layout = { kind: "object", fields }
+  } else if (v.tag == TAG.JSON) {
+    loop(buf, buf1 => {
+      let json = symbol.getSymbol("tmp_json")
+      let len = symbol.getSymbol("tmp_json_len")
+      let write = c.call("yyjson_val_write", v.val, "0", "NULL")
+      c.declareCharPtr(buf1)(json, nullable ? c.ternary(v.cond, "NULL", write) : write)
+      c.declareSize(buf1)(len, c.ternary(json, c.call("strlen", json), "0"))
+      outAlign(buf1)
+      outRaw(buf1, "uint64_t", len)
+      c.stmt(buf1)(c.call("out_str", json, len))
+      c.stmt(buf1)(c.call("free", json))
+    })
+    layout = { kind: "json" }
+  } else if (typing.isString(v.schema)) {
+    let off = symbol.getSymbol("off")
+    let len = nullable ? c.ternary(v.cond, "0", v.val.len) : v.val.len
+    outAlign(buf)
+    c.declareVar(buf)("uint64_t", off, "0")
+    outRaw(buf, "uint64_t", off)
+    loop(buf, buf1 => {
+      c.stmt(buf1)(c.assign(off, c.add(off, len)))
+      outRaw(buf1, "uint64_t", off)
+    })
+    loop(buf, buf1 => c.stmt(buf1)(c.call("out_str", v.val.str, len)))
+    layout = { kind: "string" }
+  } else {
+    let cType = utils.convertToCType(v.schema)
+    outAlign(buf)
+    loop(buf, buf1 => outRaw(buf1, cType, nullable ? c.ternary(v.cond, "0", v.val) : v.val))
+    let type = v.schema.typeSym == "dynkey" ? v.schema.keySupertype.typeSym : v.schema.typeSym
+    layout = { kind: "prim", type }
+  }
+  if (nullable) layout.nullable = true
+  return layout
+}
+
+// Emit code that writes val in the binary format, returns the layout
+let emitValWrite = (buf, val, settings) => {
+  c.comment(buf)("write binary result")
+  c.stmt(buf)(c.call("out_str", `"${MAGIC}"`, MAGIC.length))
+  return emitColumn(buf, val, (buf1, body) => body(buf1), settings)
+}
+
+let binaryEmitter = {
+  emitValWrite
+}
+
+// ----- decoder
+
+let typedArrays = {
+  [typeSyms.boolean]: Int32Array,
+  [typeSyms.u8]: Uint8Array,
+  [typeSyms.u16]: Uint16Array,
+  [typeSyms.u32]: Uint32Array,
+  [typeSyms.u64]: BigUint64Array,
+  [typeSyms.i8]: Int8Array,
+  [typeSyms.i16]: Int16Array,
+  [typeSyms.i32]: Int32Array,
+  [typeSyms.i64]: BigInt64Array,
+  [typeSyms.f32]: Float32Array,
+  [typeSyms.f64]: Float64Array,
+  [typeSyms.char]: Uint8Array,
+  [typeSyms.date]: Int32Array,
+}
+
+class Reader {
+  constructor(bytes) {
+    // typed array views need an 8-byte aligned base
+    if (bytes.byteOffset % 8 != 0) bytes = Uint8Array.from(bytes)
+    this.bytes = bytes
+    this.pos = 0
+  }
+  align() {
+    this.pos = (this.pos + 7) & ~7
+  }
+  take(n) {
+    if (this.pos + n > this.bytes.length) throw new Error("Truncated binary result")
+    let res = this.bytes.subarray(this.pos, this.pos + n)
+    this.pos += n
+    return res
+  }
+  typed(Type, n) {
+    let res = new Type(this.bytes.buffer, this.bytes.byteOffset + this.pos, n)
+    this.take(n * Type.BYTES_PER_ELEMENT)
+    return res
+  }
+  u64() {
+    this.align()
+    return Number(this.typed(BigUint64Array, 1)[0])
+  }
+}
+
+let textDecoder = new TextDecoder()
+
+// Columns: { valid, data } with data a typed array for primitives, an array
+// of strings or parsed values for strings and json, { fields } for objects
+// and an array of { count, keys, values } (or null) for maps and arrays
+let decodeColumn = (r, layout, n) => {
+  let valid = layout.nullable ? r.take(n) : undefined
+  let isValid = i => !valid || valid[i]
+  let col = { valid }
+  if (layout.kind == "prim") {
+    r.align()
+    col.data = r.typed(typedArrays[layout.type], n)
+  } else if (layout.kind == "string") {
+    r.align()
+    let off = r.typed(BigUint64Array, n + 1)
+    let bytes = r.take(Number(off[n]))
+    col.data = []
+    for (let i = 0; i < n; i++)
+      col.data.push(textDecoder.decode(bytes.subarray(Number(off[i]), Number(off[i + 1]))))
+  } else if (layout.kind == "json") {
+    col.data = []
+    for (let i = 0; i < n; i++) {
+      let text = textDecoder.decode(r.take(r.u64()))
+      col.data.push(isValid(i) ? JSON.parse(text) : undefined)
+    }
+  } else if (layout.kind == "object") {
+    col.fields = {}
+    for (let [name, field] of layout.fields)
+      col.fields[name] = decodeColumn(r, field, n)
+  } else if (layout.kind == "map" || layout.kind == "array") {
+    col.data = []
+    for (let i = 0; i < n; i++) {
+      if (!isValid(i)) {
+        col.data.push(null)
+        continue
+      }
+      let count = r.u64()
+      let keys = layout.keys?.map(key => decodeColumn(r, key, count))
+      let values = decodeColumn(r, layout.value, count)
+      col.data.push({ count, keys, values })
+    }
+  } else {
+    throw new Error("Unknown binary layout: " + layout.kind)
+  }
+  return col
+}
+
+let formatDate = (date) => {
+  let year = Math.trunc(date / 10000)
+  if (year == 0) return date
+  let pad = (x, n) => String(x).padStart(n, "0")
+  return `${pad(year, 4)}-${pad(Math.trunc(date / 100) % 100, 2)}-${pad(date % 100, 2)}`
+}
+
+// Convert entry i of a column into a plain JS value (same shape as the JSON output)
+let materialize = (layout, col, i) => {
+  if (col.valid && !col.valid[i]) return null
+  if (layout.kind == "prim") {
+    let v = col.data[i]
+    if (layout.type == typeSyms.boolean) return v != 0
+    if (layout.type == typeSyms.date) return formatDate(v)
+    if (layout.type == typeSyms.char) return String.fromCharCode(v)
+    return typeof v == "bigint" ? Number(v) : v
+  } else if (layout.kind == "string" || layout.kind == "json") {
+    return col.data[i]
+  } else if (layout.kind == "object") {
+    let res = {}
+    for (let [name, field] of layout.fields)
+      res[name] = materialize(field, col.fields[name], i)
+    return res
+  } else if (layout.kind == "map") {
+    let { count, keys, values } = col.data[i]
+    let res = {}
+    for (let j = 0; j < count; j++) {
+      let key = layout.keys.map((k, idx) => String(materialize(k, keys[idx], j))).join("")
+      res[key] = materialize(layout.value, values, j)
+    }
+    return res
+  } else {
+    let { count, values } = col.data[i]
+    let res = []
+    for (let j = 0; j < count; j++)
+      res.push(materialize(layout.value, values, j))
+    return res
+  }
+}
+
+// Decode a binary result. With columnar set, collections are returned as
+// { count, keys, values } with typed array columns instead of JS objects.
+let decodeBinary = (bytes, layout, columnar = false) => {
+  let r = new Reader(bytes)
+  if (textDecoder.decode(r.take(MAGIC.length)) != MAGIC) throw new Error("Not a binary result")
+  let col = decodeColumn(r, layout, 1)
+  if (col.valid && !col.valid[0]) return undefined
+  if (columnar && col.data && col.data[0]?.values) return col.data[0]
+  return materialize(layout, col, 0)
+}
+
+let binaryDecoder = {
+  decodeColumn,
+  decodeBinary
+}
+
+module.exports = {
+  binaryEmitter,
+  binaryDecoder
+}
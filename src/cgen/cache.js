@@ -0,0 +1,113 @@
+const crypto = require("crypto")
+const fs = require("fs").promises
+const fsSync = require("fs")
+const path = require("path")
+const os = require("child_process")
+
+// Content-addressed cache of compiled binaries.
+// The key covers everything that determines the binary: generated code,
+// compiler (including its version), flags and the rhyme-c.h that is included.
+// Each entry is <key> (the binary) and <key>.json with metadata.
+
+let compilerVersions = {}
+
+let getCompilerVersion = (compiler) => {
+  compilerVersions[compiler] ??= new Promise(resolve => {
+    os.exec(`${compiler} --version`, (err, stdout) => resolve(err ? "" : stdout))
+  })
+  return compilerVersions[compiler]
+}
+
+// rhyme-c.h as found through the -I flags
+let readRuntimeHeader = async (cFlags) => {
+  let dirs = [...cFlags.matchAll(/-I\s*(\S+)/g)].map(m => m[1])
+  for (let dir of dirs) {
+    try {
+      return await fs.readFile(path.join(dir, "rhyme-c.h"))
+    } catch (e) { }
+  }
+  return ""
+}
+
+let getCacheKey = async (code, compiler, cFlags) => {
+  let hash = crypto.createHash("sha256")
+  for (let part of [code, compiler, await getCompilerVersion(compiler), cFlags, await readRuntimeHeader(cFlags)]) {
+    hash.update(part)
+    hash.update("\0")
+  }
+  return hash.digest("hex")
+}
+
+// Process-wide counters, reported on func.explain
+let stats = { hits: 0, misses: 0 }
+
+// Copy the cached binary to out, returns the entry metadata or undefined on a miss
+let lookup = async (cacheDir, key, out) => {
+  let binary = path.join(cacheDir, key)
+  try {
+    let meta = JSON.parse(await fs.readFile(binary + ".json"))
+    await fs.copyFile(binary, out)
+    stats.hits++
+    return meta
+  } catch (e) {
+    stats.misses++
+    return undefined
+  }
+}
+
+// Add a freshly compiled binary. Entries are renamed into place so that
+// concurrent compiles never observe a partial binary.
+let store = async (cacheDir, key, out, meta) => {
+  await fs.mkdir(cacheDir, { recursive: true })
+  let binary = path.join(cacheDir, key)
+  let tmp = `${binary}.${process.pid}.tmp`
+  await fs.copyFile(out, tmp)
+  await fs.rename(tmp, binary)
+  await fs.writeFile(tmp, JSON.stringify(meta))
+  await fs.rename(tmp, binary + ".json")
+}
+
+// Observed structure sizes (settings.autoSize), stored next to the binaries
+// in sizes/<key>.json. The key covers the query, not the generated code,
+// which changes with the sizes.
+let getSizesFile = (cacheDir, ...query) => {
+  let hash = crypto.createHash("sha256")
+  for (let part of query.flat()) {
+    hash.update(part)
+    hash.update("\0")
+  }
+  return path.join(cacheDir, "sizes", hash.digest("hex") + ".json")
+}
+
+// Read while generating code, which is synchronous
+let readSizes = (file) => {
+  try {
+    return JSON.parse(fsSync.readFileSync(file))
+  } catch (e) {
+    return {}
+  }
+}
+
+// Keep the largest count seen for each structure
+let recordSizes = async (file, counts) => {
+  let sizes = readSizes(file)
+  for (let sym in counts) sizes[sym] = Math.max(sizes[sym] ?? 0, counts[sym])
+  await fs.mkdir(path.dirname(file), { recursive: true })
+  let tmp = `${file}.${process.pid}.tmp`
+  await fs.writeFile(tmp, JSON.stringify(sizes))
+  await fs.rename(tmp, file)
+}
+
+let cache = {
+  getCacheKey,
+  lookup,
+  store,
+  stats,
+  getSizesFile,
+  readSizes,
+  recordSizes
+}
+
+module.exports = {
+  cache
+}
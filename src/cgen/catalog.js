@@ -0,0 +1,185 @@
+const fs = require("fs")
+const path = require("path")
+const { typing } = require('../typing')
+const { utils } = require("./utils")
+const { shred } = require("./shred")
+const { runtime } = require("../simple-runtime")
+
+// Statistics catalog of input files (ANALYZE).
+//
+// analyze scans a CSV, TBL or NDJSON file once and records per column:
+//   count        non-null values
+//   nullFraction fraction of rows without a value
+//   distinct     HyperLogLog estimate of the number of distinct values
+//   min / max    numbers (and dates) by value, strings lexicographically
+//   avgLength    average length of string values
+//   sorted       true if the values are in ascending order and none is
+//                missing, as the values of a group are then contiguous
+//                (absent otherwise)
+// The catalog is one JSON file keyed by the input's path. Entries carry the
+// size and mtime of the file, entries of files that changed since are ignored.
+
+let defaultCatalog = "cgen-sql/catalog.json"
+
+// HyperLogLog with 2^12 registers over a 32-bit hash, ~1.6% standard error
+// (see rt.sketch in simple-runtime)
+let hllBits = 12
+
+// Values are strings as read from CSV/TBL, or JSON values for NDJSON
+let isNumeric = (schema) => schema !== undefined && typing.isNumber(schema)
+
+class ColumnStats {
+  constructor(name, schema) {
+    this.name = name
+    this.schema = schema
+    this.count = 0
+    this.numeric = isNumeric(schema) || schema === undefined
+    this.min = undefined
+    this.max = undefined
+    this.strLength = 0
+    this.sorted = true
+    this.last = undefined
+    this.hll = runtime.sketch.hllCreate(hllBits)
+  }
+
+  add(v) {
+    if (v === undefined || v === null || v === "") {
+      // the C readers turn a missing value into "" or 0, which are not in
+      // order with the others
+      this.sorted = false
+      return
+    }
+    this.count++
+    runtime.sketch.hllAdd(this.hll, typeof v == "string" ? v : JSON.stringify(v))
+    // without a schema a column is numeric as long as all its values are
+    if (this.numeric && (typeof v == "number" || (typeof v == "string" && v.trim() !== "" && !isNaN(Number(v))))) {
+      let n = Number(v)
+      if (typeof this.min != "number" || n < this.min) this.min = n
+      if (typeof this.max != "number" || n > this.max) this.max = n
+      if (n < this.last) this.sorted = false
+      this.last = n
+      return
+    }
+    if (this.numeric && this.count > 1) {
+      // seen numbers before, compare as strings from now on
+      this.min = String(this.min)
+      this.max = String(this.max)
+      this.sorted = false
+    }
+    this.numeric = false
+    let s = typeof v == "string" ? v : JSON.stringify(v)
+    if (s < this.last) this.sorted = false
+    this.last = s
+    this.strLength += s.length
+    if (this.min === undefined || s < this.min) this.min = s
+    if (this.max === undefined || s > this.max) this.max = s
+  }
+
+  result(rows) {
+    let res = {
+      type: this.schema !== undefined ? typing.prettyPrintType(this.schema) : (this.numeric ? "number" : "string"),
+      count: this.count,
+      nullFraction: rows > 0 ? (rows - this.count) / rows : 0,
+      distinct: Math.min(Math.round(runtime.sketch.hllEstimate(this.hll)), this.count),
+      min: this.min ?? null,
+      max: this.max ?? null
+    }
+    if (!this.numeric) res.avgLength = this.count > 0 ? this.strLength / this.count : 0
+    if (this.sorted && this.count > 0) res.sorted = true
+    return res
+  }
+}
+
+let formatOf = (filename) => {
+  let ext = path.extname(filename).substring(1)
+  if (ext == "json") return "ndjson"
+  return ext
+}
+
+// Scan the file and return its statistics. schema is the type passed to
+// loadCSV / loadTBL / loadNDJSON (or the record type), without a schema
+// the columns are taken from the CSV header, the TBL column positions or
+// the top-level fields of the NDJSON records.
+let analyzeFile = (filename, schema, format = formatOf(filename)) => {
+  if (!["csv", "tbl", "ndjson"].includes(format))
+    throw new Error("Cannot analyze input of format " + format)
+  let record = schema && typing.isNumber(schema.objKey) ? schema.objValue : schema
+  let fields = record ? utils.convertToArrayOfSchema(record) : undefined
+
+  let columns = {}
+  let column = (name, schema) => columns[name] ??= new ColumnStats(name, schema)
+  fields?.forEach(({ name, schema }) => column(name, schema))
+
+  let rows = 0
+  let header
+  shred.splitLines(filename, line => {
+    if (format == "ndjson") {
+      let obj = JSON.parse(line)
+      if (fields) {
+        for (let { name } of fields) columns[name].add(obj[name])
+      } else {
+        for (let name in obj) column(name).add(obj[name])
+      }
+    } else {
+      // tbl rows end with a delimiter
+      if (format == "tbl" && line.endsWith("|")) line = line.substring(0, line.length - 1)
+      let vals = line.split(format == "csv" ? "," : "|")
+      if (format == "csv" && header === undefined) {
+        header = vals
+        return
+      }
+      let names = fields ? fields.map(f => f.name) : (header ?? vals.map((v, i) => String(i)))
+      names.forEach((name, i) => column(name, fields?.[i].schema).add(vals[i]))
+    }
+    rows++
+  })
+
+  let stat = fs.statSync(filename)
+  let res = { format, size: stat.size, mtimeMs: stat.mtimeMs, rows, columns: {} }
+  for (let name in columns) res.columns[name] = columns[name].result(rows)
+  return res
+}
+
+let readCatalog = (catalog = defaultCatalog) => {
+  try {
+    return JSON.parse(fs.readFileSync(catalog))
+  } catch (e) {
+    return {}
+  }
+}
+
+// Analyze the file and add (or replace) its entry in the catalog
+let analyze = (filename, schema, { format, catalog = defaultCatalog } = {}) => {
+  let stats = analyzeFile(filename, schema, format)
+  let entries = readCatalog(catalog)
+  entries[path.normalize(filename)] = stats
+  fs.mkdirSync(path.dirname(catalog), { recursive: true })
+  fs.writeFileSync(catalog, JSON.stringify(entries, null, 2))
+  return stats
+}
+
+// Statistics of an input file, undefined if it was not analyzed or has
+// changed since
+let lookup = (entries, filename) => {
+  let stats = entries[path.normalize(filename)]
+  if (stats === undefined) return
+  try {
+    let stat = fs.statSync(filename)
+    if (stat.size != stats.size || stat.mtimeMs != stats.mtimeMs) return
+  } catch (e) {
+    return
+  }
+  return stats
+}
+
+let catalog = {
+  defaultCatalog,
+  analyzeFile,
+  analyze,
+  readCatalog,
+  lookup
+}
+
+module.exports = {
+  catalog
+}
@@ -5,7 +5,15 @@ const val = require("./value/value")
 const { symbol } = require("./symbol")
 const { csv } = require("./csv")
 const { json } = require("./json")
+const { columnar } = require("./columnar")
+const { shred } = require("./shred")
+const { catalog } = require("./catalog")
 const { printEmitter } = require("./print")
+const { binaryEmitter, binaryDecoder } = require("./binary")
+const { cache } = require("./cache")
+const { server } = require("./server")
+const { instrument } = require("./instrument")
+const { memory } = require("./memory")
 
 const { generate } = require("../new-codegen")
 const { typing, types, typeSyms } = require('../typing')
@@ -31,8 +39,10 @@ let tmpVarWriteRank
 // needs to be generated at the very beginning
 // e.g., constant strings, hashmap declarations, structs etc.
 // prolog0: before main function starts
-// prolog1: after main function starts
+// loadProlog: start of the main function and loading of the inputs
+// prolog1: after the inputs are loaded (repeated for every request in server mode)
 let prolog0
+let loadProlog
 let prolog1
 
 // Environment of input files, avoiding multiple open's of the same file
@@ -54,10 +64,54 @@ let tmpVars
 
 let visitedAssignments
 
+// Layout of the result if it is written in the binary format
+let binaryLayout
+
+// Query parameters, read from the command line arguments in order of first use
+let params
+
 let currentGroupPath
 
 let preload
+let shredded
 let linkedBuckets
+let streamJSON
+let streamBufferSize
+let serverMode
+let perfCounters
+let vectorized
+let normalizedSortKeys
+let sortThreads
+let parallelSortThreshold
+let sortMemory
+
+// Group-bys whose groups are limited to a budget: the top-level one under
+// settings.groupMemory (spilled to disk), the build side of a radix join
+let spillGroup
+let radixJoin
+
+// Top-level group-by over a sorted key, aggregated one run at a time
+let streamGroup
+// Build sides of merge joins, by assignment
+let mergeJoins
+
+// Sets of the count-distinct ops, by assignment
+let distinctSets
+
+// Sketches of the approximate aggregates, by assignment
+let sketchMaps
+
+// Entries of the statistics catalog, and the key counts estimated from them
+let catalogEntries
+let keyEstimates
+// the estimates size the hash tables unless hashSize is given
+let catalogSizing
+
+// Sort node whose result is printed up to settings.limit (resultLimit)
+let resultLimit
+let topKSort
+// Sort node whose external sort is merged while the result is printed
+let streamedSort
 
 // Collection size config
 let hashSize
@@ -94,6 +148,8 @@ let addMkset = (e1, e2, val, data) => {
   let b = getDeps(e2)
   let e = expr("MKSET", ...a)
   e.sym = b[0]
+  e.label = `${e2.op} <- ${pretty(e1)}`
+  e.filter = val.cond !== undefined
   let info = [`// generator: ${e2.op} <- ${pretty(e1)}`]
   let cond = val.cond ? c.not(val.cond) : "1"
   e.getLoopTxt = () => ({
@@ -107,6 +163,7 @@ let addGenerator = (e1, e2, getLoopTxtFunc) => {
   let b = getDeps(e2)
   let e = expr("FOR", ...a)
   e.sym = b[0]
+  e.label = `${e2.op} <- ${pretty(e1)}`
   e.getLoopTxt = getLoopTxtFunc
   generatorStms.push(e)
 }
@@ -114,16 +171,21 @@ let addGenerator = (e1, e2, getLoopTxtFunc) => {
 let reset = (settings) => {
   symbol.reset()
   hashmap.reset(settings)
+  instrument.reset(settings)
+  memory.reset(settings)
 
   assignmentStms = []
   generatorStms = []
   tmpVarWriteRank = {}
 
   prolog0 = []
+  loadProlog = []
   prolog1 = []
 
   inputFiles = {}
 
+  params = {}
+
   usedCols = {}
   sortedCols = {}
 
@@ -138,13 +200,36 @@ let reset = (settings) => {
 
   backend = settings.backend
 
+  resultLimit = settings.limit
+  topKSort = undefined
+  streamedSort = undefined
+
   hashSize = settings.hashSize || 256
   nestedHashSize = settings.nestedHashSize || 256
   bucketSize = settings.bucketSize || 64
   arraySize = settings.arraySize || 2048
 
   preload = settings.preload || false
+  shredded = settings.shredded || false
   linkedBuckets = settings.linkedBuckets || false
+  streamJSON = settings.streamJSON || false
+  streamBufferSize = settings.streamBufferSize || 1048576
+  serverMode = settings.server || false
+  perfCounters = settings.perfCounters || false
+  vectorized = settings.vectorized || false
+  normalizedSortKeys = settings.normalizedSortKeys || false
+  sortThreads = settings.sortThreads || 1
+  parallelSortThreshold = settings.parallelSortThreshold ?? 100000
+  sortMemory = settings.sortMemory
+  spillGroup = undefined
+  radixJoin = undefined
+  streamGroup = undefined
+  mergeJoins = {}
+  distinctSets = {}
+  sketchMaps = {}
+  catalogEntries = settings.catalog ? catalog.readCatalog(settings.catalog) : {}
+  keyEstimates = {}
+  catalogSizing = settings.hashSize === undefined
 }
 
 let stripConverts = q => {
@@ -160,30 +245,58 @@ let initializeProlog = () => {
     prolog0.push("#include <cublas_v2.h>")
   }
 
+  if (serverMode) prolog0.push("#define RHYME_SERVER")
+  if (perfCounters) prolog0.push("#define RHYME_PERF")
+  if (memory.isEnabled()) prolog0.push("#define RHYME_MEMSTATS")
+  if (sortThreads > 1) prolog0.push("#define RHYME_PARALLEL_SORT")
+  if (Object.values(assignments).some(a => approxOps.includes(a.op))) prolog0.push("#define RHYME_SKETCH")
   prolog0.push(`#include "rhyme-c.h"`)
 
   prolog0.push(`typedef int (*__compar_fn_t)(const void *, const void *);`)
-  prolog1.push("int main() {")
+  loadProlog.push("int main(int argc, char **argv) {")
+  if (perfCounters) c.stmt(loadProlog)(c.call("perf_open"))
 
   if (backend == "cuda") {
-    c.declareVar(prolog1)("cublasHandle_t", "handle")
-    c.stmt(prolog1)(c.call("cublasCreate", "&handle"))
+    c.declareVar(loadProlog)("cublasHandle_t", "handle")
+    c.stmt(loadProlog)(c.call("cublasCreate", "&handle"))
   }
 }
 
 // construct the prolog with prolog0 and prolog1
+// Shredded NDJSON inputs are read from column files without yyjson
+let usesYYJSON = () => inputFiles["json"] ||
+  Object.values(inputFiles["ndjson"] ?? {}).some(v => v.tag != TAG.COLUMNAR)
+
 let finalizeProlog = () => {
-  let prolog = [...prolog0, ...prolog1]
-  if (inputFiles["json"] || inputFiles["ndjson"]) {
+  let prolog = [...prolog0, ...loadProlog]
+  if (serverMode) {
+    // everything after the inputs are loaded runs once per request
+    c.stmt(prolog)(c.call("server_begin"))
+    prolog.push("while (server_next_request(&argc, &argv)) {")
+  }
+  prolog.push(...prolog1)
+  if (spillGroup) {
+    c.declareVar(prolog)("spill_groups", "spill")
+    c.stmt(prolog)(c.call("spill_init", "&spill"))
+    c.outLit(prolog)("{")
+  }
+  if (radixJoin) emitRadixPassStart(prolog, tmpVars[radixJoin.i], radixJoin.bits)
+  if (streamGroup) {
+    c.declareVar(prolog)("long", "run_printed", "0")
+    c.outLit(prolog)("{")
+  }
+  if (usesYYJSON()) {
     // include necessary header if we loaded in any JSON file
     prolog = ["#include \"yyjson.h\"", ...prolog]
   }
   return prolog
 }
 
-// Emit the comapre function for qsort
+// Emit the compare function of a sort. Ties are broken by the index, so the
+// order does not depend on the sort algorithm (and matches a stable sort).
+// The function is inlined into the sort routine emitted for the sort site.
 let emitCompareFunc = (buf, name, valPairs, orders) => {
-  buf.push(`int ${name}(int *i, int *j) {`)
+  buf.push(`static inline int ${name}(int *i, int *j) {`)
   for (let i in valPairs) {
     let [aVal, bVal] = valPairs[i]
     let order = orders[i]
@@ -202,73 +315,126 @@ let emitCompareFunc = (buf, name, valPairs, orders) => {
       c.declareInt(buf)(tmp, c.ternary(c.lt(aVal.val, bVal.val), "-1", c.ternary(c.gt(aVal.val, bVal.val), "1", "0")))
     }
 
-    if (i == valPairs.length - 1) {
-      c.return(buf)(tmp)
-    } else {
-      c.if(buf)(c.ne(tmp, "0"), buf1 => {
-        c.return(buf1)(tmp)
-      })
-    }
+    c.if(buf)(c.ne(tmp, "0"), buf1 => {
+      c.return(buf1)(tmp)
+    })
   }
+  c.return(buf)(c.sub("*i", "*j"))
   buf.push(`}`)
 }
 
-let emitArraySorting = (buf, q, arr) => {
-  let sym = arr.val.sym
-  let count = arr.val.count
-
-  let columns = q.arg.slice(1)
-
-  let vals = []
-  let orders = []
-  let arrayEntry1 = array.getValueAtIdx(arr, "*i")
-  let arrayEntry2 = array.getValueAtIdx(arr, "*j")
+// Radix sort key (see rhyme-c.h) of a single numeric or date sort column
+let getRadixKey = (val, order) => {
+  let schema = val.schema
+  if (!(typing.isNumber(schema) || schema.typeSym == typeSyms.date)) return
+  let cType = utils.convertToCType(schema)
+  let key
+  if (cType == "float" || cType == "double") {
+    key = c.call("radix_key_double", val.val)
+  } else if (cType.startsWith("uint")) {
+    key = c.cast("uint64_t", val.val)
+  } else {
+    key = c.call("radix_key_int", val.val)
+  }
+  return order == 1 ? `~${key}` : key
+}
 
+// Sort with normalized keys (settings.normalizedSortKeys): the sort columns
+// of each entry are encoded into a fixed-width key whose memcmp order is the
+// sort order. Numbers and dates take 8 bytes (the radix keys), strings a
+// zero-padded prefix of sortKeyPrefix bytes; descending columns are inverted.
+// Columns after the first string cannot be encoded, its prefix may be
+// truncated. Entries with equal keys are compared with the compare function.
+// Returns false if the first column cannot be encoded.
+let sortKeyPrefix = 16
+
+// Statements that encode the sort columns of entry into the normalized key
+// at key, and the width of the key
+let getSortKeyPuts = (entry, columns, key) => {
+  let puts = []
+  let width = 0
   for (let i = 0; i < columns.length; i += 2) {
-    let column = columns[i]
-    let order = columns[i + 1]
-
-    if (arrayEntry1.tag != TAG.OBJECT || arrayEntry2.tag != TAG.OBJECT) {
-      throw new Error("Sorting not supported here")
+    let val = entry.val[columns[i].op]
+    let desc = columns[i + 1].op == 1 ? "1" : "0"
+    let p = `${key} + ${width}`
+    if (typing.isString(val.schema)) {
+      puts.push(c.call("sortkey_put_str", p, val.val.str, val.val.len, sortKeyPrefix, desc))
+      width += sortKeyPrefix
+      break
     }
-    vals.push([
-      arrayEntry1.val[column.op],
-      arrayEntry2.val[column.op]
-    ])
-    orders.push(order.op)
+    let radixKey = getRadixKey(val, 0)
+    if (radixKey === undefined) break
+    puts.push(c.call("sortkey_put_u64", p, radixKey, desc))
+    width += 8
   }
+  return { puts, width }
+}
 
-  let compareFunc = symbol.getSymbol("compare_func")
-  emitCompareFunc(prolog0, compareFunc, vals, orders)
+let emitNormalizedKeySort = (buf, sym, count, first, entryAt, columns, compareFunc) => {
+  let idx = first == "0" ? "i" : c.add("i", first)
+  let { puts, width } = getSortKeyPuts(entryAt(idx), columns, `${sym}_key`)
+  if (width == 0) return false
+
+  let keys = `${sym}_keys`
+  let keyCompareFunc = symbol.getSymbol("compare_func")
+  let sortFunc = symbol.getSymbol("sort_func")
+  let keyAt = (i) => `${keys} + (size_t)${first == "0" ? i : c.sub(i, first)} * ${width}`
+  c.declarePtr(prolog0)("unsigned char", keys)
+  prolog0.push(`static inline int ${keyCompareFunc}(int *i, int *j) {`)
+  c.declareInt(prolog0)("res", c.call("memcmp", keyAt("*i"), keyAt("*j"), width))
+  c.return(prolog0)(c.ternary("res", "res", c.call(compareFunc, "i", "j")))
+  prolog0.push(`}`)
+  prolog0.push(`RHYME_DEFINE_SORT(${sortFunc}, ${keyCompareFunc})`)
 
   c.declareIntPtr(buf)(sym, c.cast("int *", c.malloc("int", count)))
-  c.stmt(buf)(`for (int i = 0; i < ${count}; i++) ${sym}[i] = i`)
-
-  c.stmt(buf)(c.call("qsort", sym, count, "sizeof(int)", c.cast("__compar_fn_t", compareFunc)))
-
-  arr.val.sorted = true
+  c.stmt(buf)(c.assign(keys, c.cast("unsigned char *", c.malloc("unsigned char", `(size_t)${count} * ${width}`))))
+  buf.push(`for (int i = 0; i < ${count}; i++) {`)
+  c.stmt(buf)(c.assign(`${sym}[i]`, idx))
+  c.declarePtr(buf)("unsigned char", `${sym}_key`, `${keys} + (size_t)i * ${width}`)
+  puts.forEach(put => c.stmt(buf)(put))
+  buf.push(`}`)
+  emitSortCall(buf, sortFunc, sym, count)
+  c.stmt(buf)(c.call("free", keys))
+  return true
 }
 
-let emitHashMapSorting = (buf, q, map) => {
-  let sym = tmpSym(map.val.sym)
-  let count = map.val.count
+// Call the sort routine defined with RHYME_DEFINE_SORT, on sortThreads
+// threads if the array has at least parallelSortThreshold entries
+let emitSortCall = (buf, sortFunc, sym, count) => {
+  if (sortThreads > 1)
+    c.stmt(buf)(c.call("parallel_sort", sym, count, sortThreads, parallelSortThreshold, sortFunc, `${sortFunc}_merge`))
+  else
+    c.stmt(buf)(c.call(sortFunc, sym, count))
+}
 
+// Sort the indices first .. first + count - 1 into sym by the columns of the
+// sort op. entryAt(idx) is the entry at an index expression.
+//
+// A single numeric or date column is sorted with an LSD radix sort on
+// (key, index) pairs, everything else with an introsort that is specialized
+// for the sort site (RHYME_DEFINE_SORT), optionally on normalized keys and
+// in parallel (settings.sortThreads). With a memory budget in bytes for the
+// sort (settings.sortMemory) sorted runs are spilled to disk and merged
+// (emitExternalSort). If only the first settings.limit entries of the
+// result are printed, they are selected with a bounded heap
+// and the index array is allocated for them only.
+let emitSortIndices = (buf, q, sym, count, first, entryAt) => {
   let columns = q.arg.slice(1)
 
   let vals = []
   let orders = []
-  let hashMapEntry1 = hashmap.getHashMapValueEntry(map, undefined, "*i")
-  let hashMapEntry2 = hashmap.getHashMapValueEntry(map, undefined, "*j")
+  let entry1 = entryAt("*i")
+  let entry2 = entryAt("*j")
   for (let i = 0; i < columns.length; i += 2) {
     let column = columns[i]
     let order = columns[i + 1]
 
-    if (hashMapEntry1.tag != TAG.OBJECT || hashMapEntry2.tag != TAG.OBJECT) {
+    if (entry1.tag != TAG.OBJECT || entry2.tag != TAG.OBJECT) {
       throw new Error("Sorting not supported here")
     }
     vals.push([
-      hashMapEntry1.val[column.op],
-      hashMapEntry2.val[column.op]
+      entry1.val[column.op],
+      entry2.val[column.op]
     ])
     orders.push(order.op)
   }
@@ -276,16 +442,85 @@ let emitHashMapSorting = (buf, q, map) => {
   let compareFunc = symbol.getSymbol("compare_func")
   emitCompareFunc(prolog0, compareFunc, vals, orders)
 
-  c.declareIntPtr(buf)(sym, c.cast("int *", c.malloc("int", count)))
-  c.stmt(buf)(`for (int i = 0; i < ${count}; i++) ${sym}[i] = i + 1`)
+  let idx = first == "0" ? "i" : c.add("i", first)
+  let merge
+  instrument.emitPhaseStart(buf, "sort")
+  if (q === topKSort) {
+    let k = c.ternary(c.lt(resultLimit, count), resultLimit, count)
+    c.declareIntPtr(buf)(sym, c.cast("int *", c.malloc("int", k)))
+    c.stmt(buf)(c.call("topk_sort", sym, resultLimit, first, count, c.cast("__compar_fn_t", compareFunc)))
+  } else if (sortMemory) {
+    merge = emitExternalSort(buf, q, sym, count, idx, entryAt, columns, compareFunc)
+  } else if (vals.length == 1 && getRadixKey(vals[0][0], orders[0])) {
+    let keys = `${sym}_keys`
+    let key = getRadixKey(entryAt(idx).val[columns[0].op], orders[0])
+    c.declareIntPtr(buf)(sym, c.cast("int *", c.malloc("int", count)))
+    c.declarePtr(buf)("uint64_t", keys, c.cast("uint64_t *", c.malloc("uint64_t", count)))
+    c.stmt(buf)(`for (int i = 0; i < ${count}; i++) ${sym}[i] = ${idx}, ${keys}[i] = ${key}`)
+    c.stmt(buf)(c.call("radix_sort", keys, sym, count))
+    c.stmt(buf)(c.call("free", keys))
+  } else if (!(normalizedSortKeys && emitNormalizedKeySort(buf, sym, count, first, entryAt, columns, compareFunc))) {
+    let sortFunc = symbol.getSymbol("sort_func")
+    prolog0.push(`RHYME_DEFINE_SORT(${sortFunc}, ${compareFunc})`)
+    c.declareIntPtr(buf)(sym, c.cast("int *", c.malloc("int", count)))
+    c.stmt(buf)(`for (int i = 0; i < ${count}; i++) ${sym}[i] = ${idx}`)
+    emitSortCall(buf, sortFunc, sym, count)
+  }
+  instrument.emitPhaseEnd(buf, "sort")
+  return merge
+}
 
-  c.stmt(buf)(c.call("qsort", sym, count, "sizeof(int)", c.cast("__compar_fn_t", compareFunc)))
+// External sort (settings.sortMemory): the normalized keys of the sort
+// columns are written with the entry indices into runs that fit the budget
+// (see sort_merge in rhyme-c.h). Entries with equal keys are compared with
+// the compare function. The merge of the top-level result is streamed into
+// the print loop, returns its symbol, otherwise sym holds the merged indices.
+let emitExternalSort = (buf, q, sym, count, idx, entryAt, columns, compareFunc) => {
+  let merge = `${sym}_merge`
+  let key = `${sym}_key`
+  let { puts, width } = getSortKeyPuts(entryAt(idx), columns, key)
+
+  let recCompareFunc = symbol.getSymbol("compare_func")
+  prolog0.push(`static inline int ${recCompareFunc}(const void *a, const void *b) {`)
+  if (width > 0) {
+    c.declareInt(prolog0)("res", c.call("memcmp", "a", "b", width))
+    c.if(prolog0)("res", buf1 => c.return(buf1)("res"))
+  }
+  prolog0.push(`int i, j;`)
+  c.stmt(prolog0)(c.call("memcpy", "&i", `(const unsigned char *)a + ${width}`, "sizeof(int)"))
+  c.stmt(prolog0)(c.call("memcpy", "&j", `(const unsigned char *)b + ${width}`, "sizeof(int)"))
+  c.return(prolog0)(c.call(compareFunc, "&i", "&j"))
+  prolog0.push(`}`)
+
+  c.stmt(buf)(`sort_merge ${merge}`)
+  c.stmt(buf)(c.call("sort_merge_init", "&" + merge, count, width, sortMemory, recCompareFunc))
+  buf.push(`for (int i = 0; i < ${count}; i++) {`)
+  if (width > 0) {
+    c.declarePtr(buf)("unsigned char", key, c.call("sort_merge_add", "&" + merge, idx))
+    puts.forEach(put => c.stmt(buf)(put))
+  } else {
+    c.stmt(buf)(c.call("sort_merge_add", "&" + merge, idx))
+  }
+  buf.push(`}`)
+  c.stmt(buf)(c.call("sort_merge_finish", "&" + merge))
+  if (q === streamedSort) return merge
+  c.declareIntPtr(buf)(sym, c.call("sort_merge_all", "&" + merge, count))
+}
 
+// An external sort that is streamed into the print loop leaves the merge in
+// val.merge instead of the sorted indices
+let emitArraySorting = (buf, q, arr) => {
+  arr.val.merge = emitSortIndices(buf, q, arr.val.sym, arr.val.count, "0", idx => array.getValueAtIdx(arr, idx))
+  arr.val.sorted = true
+}
+
+let emitHashMapSorting = (buf, q, map) => {
+  map.val.merge = emitSortIndices(buf, q, tmpSym(map.val.sym), map.val.count, "1", idx => hashmap.getHashMapValueEntry(map, undefined, idx))
   map.val.sorted = true
 }
 
 let emitStatefulInit = (buf, q, lhs) => {
-  if (q.op == "sum" || q.op == "count") {
+  if (q.op == "sum" || q.op == "count" || q.op == "countDistinct" || q.op == "approxCountDistinct") {
     c.stmt(buf)(c.assign(lhs.val, "0"))
   } else if (q.op == "product") {
     c.stmt(buf)(c.assign(lhs.val, "1"))
@@ -308,8 +543,11 @@ let emitStatefulInit = (buf, q, lhs) => {
 }
 
 let emitStatefulUpdate1 = (buf, q, lhs, rhs) => {
+  // rows that reach the op, i.e. passed all of its filters
+  let i = assignments.indexOf(q)
+  instrument.emitInc(buf, instrument.counter("stateful", tmpSym(i), "updates", pretty(q)))
   if (rhs.tag == TAG.JSON) {
-    let schema = q.op == "array" ? q.schema.type.objValue : q.schema.type
+    let schema = q.op == "array" ? q.schema.type.objValue : approxOps.includes(q.op) || q.op == "countDistinct" ? q.arg[0].schema.type : q.schema.type
     rhs = json.convertJSONTo(rhs, schema)
   }
   if (q.mode == "maybe") {
@@ -322,6 +560,36 @@ let emitStatefulUpdate1 = (buf, q, lhs, rhs) => {
     c.stmt(buf)(c.assign(lhs.val, c.binary(lhs.val, rhs.val, "+")))
   } else if (q.op == "count") {
     c.stmt(buf)(c.assign(lhs.val, c.binary(lhs.val, "1", "+")))
+  } else if (q.op == "countDistinct") {
+    // count the values not seen before in the group of the counter
+    let set = getDistinctSet(i)
+    let args
+    if (typing.isString(q.arg[0].schema.type)) {
+      let { str, len } = rhs.val
+      args = [c.call("hash", str, len), str, len, rhs.transient ? "1" : "0"]
+    } else if (getRadixKey(rhs, 0)) {
+      args = [getRadixKey(rhs, 0), "NULL", "0", "0"]
+    } else {
+      throw new Error("Cannot count distinct values of type " + typing.prettyPrintType(q.arg[0].schema.type))
+    }
+    c.if(buf)(c.call("distinct_add", "&" + set, "&" + lhs.val, ...args), buf1 => {
+      c.stmt(buf1)(c.assign(lhs.val, c.binary(lhs.val, "1", "+")))
+    })
+  } else if (q.op == "approxCountDistinct") {
+    let map = getSketchMap(i, q)
+    let value
+    if (typing.isString(q.arg[0].schema.type)) {
+      value = c.call("hash", rhs.val.str, rhs.val.len)
+    } else if (getRadixKey(rhs, 0)) {
+      value = getRadixKey(rhs, 0)
+    } else {
+      throw new Error("Cannot count distinct values of type " + typing.prettyPrintType(q.arg[0].schema.type))
+    }
+    c.stmt(buf)(c.call("hll_add", c.call("sketch_hll", "&" + map, "&" + lhs.val, getSketchParam(q)), value))
+  } else if (q.op == "approxQuantile" || q.op == "median") {
+    let map = getSketchMap(i, q)
+    if (lhs.defined) c.stmt(buf)(c.assign(lhs.defined, "1"))
+    c.stmt(buf)(c.call("tdigest_add", c.call("sketch_tdigest", "&" + map, "&" + lhs.val), c.cast("double", rhs.val)))
   } else if (q.op == "product") {
     c.stmt(buf)(c.assign(lhs.val, c.binary(lhs.val, rhs.val, "*")))
   } else if (q.op == "min") {
@@ -332,14 +600,17 @@ let emitStatefulUpdate1 = (buf, q, lhs, rhs) => {
     c.if(buf)(c.not(lhs.defined), (buf1) => {
       c.stmt(buf1)(c.assign(lhs.defined, "1"))
       if (typing.isString(q.arg[0].schema.type)) {
-        let { str: lhsStr, len: lhsLen } = lhs.val
-        let { str: rhsStr, len: rhsLen } = rhs.val
-        c.stmt(buf1)(c.assign(lhsStr, rhsStr))
-        c.stmt(buf1)(c.assign(lhsLen, rhsLen))
+        utils.emitStoreString(buf1, lhs.val, rhs)
       } else {
         c.stmt(buf1)(c.assign(lhs.val, rhs.val))
       }
     })
+  } else if (q.op == "single" && rhs.transient) {
+    // All values are expected to be the same, only copy the first one
+    c.if(buf)(c.not(lhs.defined), (buf1) => {
+      c.stmt(buf1)(c.assign(lhs.defined, "1"))
+      utils.emitStoreString(buf1, lhs.val, rhs)
+    })
   } else if (q.op == "single") {
     c.if(buf)(c.not(lhs.defined), (buf1) => {
       c.stmt(buf1)(c.assign(lhs.defined, "1"))
@@ -358,21 +629,96 @@ let emitStatefulUpdate1 = (buf, q, lhs, rhs) => {
   } else if (q.op == "print") {
     if (typing.isString(q.arg[0].schema.type)) {
       let { str, len } = rhs.val
-      c.stmt(buf)(c.call("printf", `"%.*s\\n"`, len, str))
+      c.outStr(buf)(str, len)
     } else {
-      c.stmt(buf)(c.call("printf", `"%${utils.getFormatSpecifier(q.arg[0].schema.type)}\\n"`, rhs.val))
+      c.outVal(buf)(q.arg[0].schema.type, rhs.val)
     }
+    c.outLit(buf)("\n")
   } else {
     throw new Error("stateful op not supported: " + pretty(q))
   }
 }
 
+// Count-distinct (countDistinct): the values seen by all groups of the op
+// are kept in one set of (group, value) pairs, see distinct_add in rhyme-c.h
+let getDistinctSet = (i) => {
+  if (distinctSets[i]) return distinctSets[i]
+  let set = `${tmpSym(i)}_distinct`
+  c.declareVar(prolog1)("distinct_set", set, "{ 0 }")
+  return distinctSets[i] = set
+}
+
+// Approximate aggregates: the sketch of each group (see sketch_map in
+// rhyme-c.h) is kept by the address of the group's result, which is written
+// once the loops are done. approxCountDistinct(e, p) uses 2^p registers,
+// approxQuantile(e, q) estimates the q-quantile, median(e) the 0.5-quantile.
+let approxOps = ["approxCountDistinct", "approxQuantile", "median"]
+
+let getSketchParam = (q) => {
+  if (q.op == "median") return 0.5
+  let [lo, hi, dflt] = q.op == "approxCountDistinct" ? [4, 18, 12] : [0, 1, undefined]
+  let p = q.arg[1] ? stripConverts(q.arg[1]) : undefined
+  if (p === undefined && dflt !== undefined) return dflt
+  if (p?.key != "const" || typeof p.op != "number" || p.op < lo || p.op > hi)
+    throw new Error(`${q.op} expects a constant between ${lo} and ${hi} but got: ` + (p ? pretty(p) : "nothing"))
+  return p.op
+}
+
+let getSketchMap = (i, q) => {
+  if (sketchMaps[i]) return sketchMaps[i].sym
+  let sym = `${tmpSym(i)}_sketches`
+  c.declareVar(prolog1)("sketch_map", sym, "{ 0 }")
+  sketchMaps[i] = { sym, q }
+  return sym
+}
+
+let emitSketchResults = (buf) => {
+  for (let i in sketchMaps) {
+    let { sym, q } = sketchMaps[i]
+    if (q.op == "approxCountDistinct") c.stmt(buf)(c.call("hll_finish", "&" + sym))
+    else c.stmt(buf)(c.call("tdigest_finish", "&" + sym, getSketchParam(q)))
+  }
+}
+
+// Sketches are declared up front as the results are written in the epilog,
+// which is emitted before the loops. Nothing computed in the loops may read
+// the results: only group-bys holding them as values
+let collectSketchMaps = () => {
+  let heldRefs = e => {
+    e = stripConverts(e)
+    if (e.key == "ref") return [String(e.op)]
+    if (e.key == "pure" && e.op == "mkTuple") return e.arg.filter((_, k) => k % 2 == 1).flatMap(heldRefs)
+    return []
+  }
+  let holders = new Set(Object.keys(assignments).filter(i => approxOps.includes(assignments[i].op)))
+  if (holders.size == 0) return
+  holders.forEach(i => getSketchMap(i, assignments[i]))
+  let changed = true
+  while (changed) {
+    changed = false
+    for (let j in assignments) {
+      let a = assignments[j]
+      if (!holders.has(j) && a.key == "update" && heldRefs(a.arg[2]).some(t => holders.has(t))) {
+        holders.add(j)
+        changed = true
+      }
+    }
+  }
+  for (let j in assignments) {
+    if (!holders.has(j) && assignments[j].tmps.some(t => holders.has(String(t))))
+      throw new Error("Approximate aggregates can only be part of the result, but are used by: " + pretty(assignments[j]))
+  }
+}
+
 let emitStatefulUpdate = (buf, q, lhs) => {
   let e = q.arg[0]
   let rhs = emitPath(buf, e)
   if (rhs.cond) {
     let cond = rhs.cond
+    // rows passing the condition on the value of the op
+    let passed = instrument.counter("filter", tmpSym(assignments.indexOf(q)), "passed", pretty(e))
     c.if(buf)(c.not(cond), buf1 => {
+      instrument.emitInc(buf1, passed)
       emitStatefulUpdate1(buf1, q, lhs, rhs)
     })
   } else {
@@ -380,6 +726,175 @@ let emitStatefulUpdate = (buf, q, lhs) => {
   }
 }
 
+// Vectorized execution (settings.vectorized)
+//
+// A top-level aggregate over the rows of a single columnar or preloaded
+// input is computed in batches of RHYME_VEC_SIZE rows instead of in the
+// tuple-at-a-time loop. A load loop reads the leaves of the argument (the
+// columns, and subexpressions without a kernel) into typed vectors. Then
+// comparison kernels narrow a selection vector of the rows of the batch,
+// arithmetic kernels compute whole vectors, and an aggregation kernel
+// reduces the values of the selected rows (see vec_sel_vs, vec_arith_vv,
+// vec_sum etc. in rhyme-c.h). The loops are free of branches on the data,
+// so they can be compiled to SIMD code.
+let vectorOps = ["sum", "count", "min", "max"]
+
+// Number of rows of the input the aggregate loops over, undefined if the
+// aggregate cannot be vectorized
+let getVectorRows = (q) => {
+  if (q.key != "stateful" || !vectorOps.includes(q.op)) return
+  if (q.fre.length > 0 || q.tmps.length > 0 || q.bnd.length != 1) return
+  if (q.op != "count" && !typing.isNumber(q.schema.type)) return
+  let v = q.bnd[0]
+  let gens = filters.filter(f => f.arg[1].op == v)
+  if (gens.length != 1 || gens[0].arg[0].key != "loadInput") return
+  let lhs = vars[v]?.lhs?.[pretty(gens[0].arg[0])]
+  if (lhs?.tag == TAG.COLUMNAR) return lhs.val.rows
+  // preloaded CSV, NDJSON records are not stored as typed columns
+  if (lhs?.tag == TAG.ARRAY && !lhs.cond && Object.values(lhs.val.values).every(v => v.tag != TAG.JSON)) return lhs.val.count
+}
+
+let vectorCompare = { equal: "==", notEqual: "!=", lessThan: "<", greaterThan: ">", lessThanOrEqual: "<=", greaterThanOrEqual: ">=" }
+// the same comparison with the sides swapped
+let flippedCompare = { "==": "==", "!=": "!=", "<": ">", ">": "<", "<=": ">=", ">=": "<=" }
+let vectorArith = { plus: "+", minus: "-", times: "*" }
+
+let containsOp = (e, ops) => e.key == "pure" && ops.includes(e.op) || (e.arg ?? []).some(e1 => containsOp(e1, ops))
+
+// Split the argument of a vectorized aggregate into the leaves read by the
+// load loop and the kernels that run on the batch. Operands are { scalar }
+// (a constant C expression) or { vec, cType }. needValue is false for the
+// parts of which only the rows they are defined for matter.
+let planVector = (arg, needValue) => {
+  let leaves = {}
+  let kernels = []
+  let isNum = e => typing.isNumber(e.schema.type)
+
+  let leaf = (e, needValue) => {
+    let l = leaves[pretty(e)] ??= { e }
+    if (needValue && isNum(e) && !l.vec) {
+      l.vec = symbol.getSymbol("vec_col")
+      l.cType = utils.convertToCType(e.schema.type)
+    }
+    return l.vec ? { vec: l.vec, cType: l.cType } : { scalar: "1" }
+  }
+
+  let visit = (e, needValue) => {
+    if (e.key == "const" && typeof e.op == "number") return { scalar: String(e.op) }
+    if (e.key != "pure") return leaf(e, needValue)
+    if (e.op == "and" || e.op == "andAlso") {
+      visit(e.arg[0], false)
+      return visit(e.arg[1], needValue)
+    }
+    if (e.op.startsWith("convert_") && isNum(e) && isNum(e.arg[0])) {
+      let a = visit(e.arg[0], needValue)
+      let cType = utils.convertToCType(e.schema.type)
+      if (!needValue || a.cType == cType) return a
+      if (a.scalar !== undefined) return { scalar: c.cast(cType, `(${a.scalar})`) }
+      let out = symbol.getSymbol("vec_tmp")
+      kernels.push((buf, sel, nsel, n) => {
+        c.declareArr(buf)(cType, out, "RHYME_VEC_SIZE")
+        c.stmt(buf)(c.call("vec_cast", cType, out, a.vec, n))
+      })
+      return { vec: out, cType }
+    }
+    let numeric = e.arg.length == 2 && e.arg.every(isNum)
+    let op = vectorCompare[e.op]
+    if (op && numeric && e.arg.some(e1 => !(e1.key == "const" && typeof e1.op == "number"))) {
+      let [a, b] = e.arg.map(e1 => visit(e1, true))
+      kernels.push((buf, sel, nsel) => {
+        if (a.vec && b.vec) c.stmt(buf)(c.call("vec_sel_vv", sel, nsel, a.vec, op, b.vec))
+        else if (a.vec) c.stmt(buf)(c.call("vec_sel_vs", sel, nsel, a.vec, op, b.scalar))
+        else c.stmt(buf)(c.call("vec_sel_vs", sel, nsel, b.vec, flippedCompare[op], a.scalar))
+      })
+      return { scalar: "1" }
+    }
+    op = vectorArith[e.op]
+    if (op && numeric && isNum(e)) {
+      let [a, b] = e.arg.map(e1 => visit(e1, needValue))
+      if (!needValue) return { scalar: "0" }
+      if (a.scalar !== undefined && b.scalar !== undefined) return { scalar: `(${a.scalar} ${op} ${b.scalar})` }
+      let out = symbol.getSymbol("vec_tmp")
+      let cType = utils.convertToCType(e.schema.type)
+      kernels.push((buf, sel, nsel, n) => {
+        c.declareArr(buf)(cType, out, "RHYME_VEC_SIZE")
+        if (a.vec && b.vec) c.stmt(buf)(c.call("vec_arith_vv", cType, out, a.vec, op, b.vec, n))
+        else if (a.vec) c.stmt(buf)(c.call("vec_arith_vs", cType, out, a.vec, op, b.scalar, n))
+        else c.stmt(buf)(c.call("vec_arith_sv", cType, out, a.scalar, op, b.vec, n))
+      })
+      return { vec: out, cType }
+    }
+    return leaf(e, needValue)
+  }
+
+  // leaves are read for all rows of the batch, an integer division has to
+  // stay behind the conditions of its row
+  let value = containsOp(arg, ["div", "mod"]) ? leaf(arg, needValue) : visit(arg, needValue)
+  return { leaves: Object.values(leaves), kernels, value }
+}
+
+let emitVectorizedUpdate = (buf, q, lhs, rows) => {
+  let x = quoteVar(q.bnd[0])
+  let base = symbol.getSymbol("vec_base")
+  let n = symbol.getSymbol("vec_n")
+  let k = symbol.getSymbol("vec_k")
+  let sel = symbol.getSymbol("vec_sel")
+  let nsel = symbol.getSymbol("vec_nsel")
+  let vals = symbol.getSymbol("vec_vals")
+  let cType = utils.convertToCType(lhs.schema)
+  let { leaves, kernels, value } = planVector(q.arg[0], q.op != "count")
+
+  buf.push(`for (size_t ${base} = 0; ${base} < ${rows}; ${base} += RHYME_VEC_SIZE) {`)
+  c.declareSize(buf)(n, `${rows} - ${base} < RHYME_VEC_SIZE ? ${rows} - ${base} : RHYME_VEC_SIZE`)
+
+  // load loop, the row is named like the loop variable so that the leaves
+  // read the columns at it. A row is selected if all leaves are defined.
+  let load = []
+  let conds = []
+  load.push(`for (size_t ${k} = 0; ${k} < ${n}; ${k}++) {`)
+  c.declareSize(load)(x, c.add(base, k))
+  for (let l of leaves) {
+    let e = emitPath(load, l.e)
+    if (e.tag == TAG.JSON) e = json.convertJSONTo(e, l.e.schema.type)
+    if (l.vec) c.stmt(load)(c.assign(`${l.vec}[${k}]`, e.cond ? `(${e.cond}) ? 0 : (${e.val})` : e.val))
+    if (e.cond) conds.push(e.cond)
+  }
+  let mask = symbol.getSymbol("vec_mask")
+  if (conds.length > 0) c.stmt(load)(c.assign(`${mask}[${k}]`, conds.map(cond => `!(${cond})`).join(" & ")))
+  load.push("}")
+
+  for (let l of leaves) if (l.vec) c.declareArr(buf)(l.cType, l.vec, "RHYME_VEC_SIZE")
+  if (conds.length > 0) c.declareArr(buf)("uint8_t", mask, "RHYME_VEC_SIZE")
+  buf.push(...load)
+
+  c.declareArr(buf)("uint16_t", sel, "RHYME_VEC_SIZE")
+  c.declareSize(buf)(nsel)
+  if (conds.length > 0) c.stmt(buf)(c.call("vec_sel_mask", sel, nsel, mask, n))
+  else c.stmt(buf)(c.call("vec_sel_all", sel, nsel, n))
+  for (let kernel of kernels) kernel(buf, sel, nsel, n)
+
+  let i = assignments.indexOf(q)
+  let updates = instrument.counter("stateful", tmpSym(i), "updates", pretty(q))
+  if (updates) c.stmt(buf)(c.assign(updates, c.add(updates, nsel)))
+
+  // aggregation kernel
+  if (q.mode == "maybe") {
+    c.if(buf)(c.and(nsel, c.not(lhs.defined)), buf1 => {
+      c.stmt(buf1)(c.assign(lhs.defined, "1"))
+      emitStatefulInit(buf1, q, lhs)
+    })
+  }
+  if (q.op == "count") {
+    c.stmt(buf)(c.assign(lhs.val, c.add(lhs.val, nsel)))
+  } else {
+    c.declareArr(buf)(cType, vals, "RHYME_VEC_SIZE")
+    if (value.vec) c.stmt(buf)(c.call("vec_gather", cType, vals, value.vec, sel, nsel))
+    else c.stmt(buf)(c.call("vec_fill", cType, vals, value.scalar, nsel))
+    c.stmt(buf)(c.call("vec_" + q.op, cType, lhs.val, vals, nsel))
+  }
+  buf.push("}")
+}
+
 let emitStatefulInPath = (i) => {
   let q = assignments[i]
   let sym = tmpSym(i)
@@ -401,6 +916,16 @@ let emitStatefulInPath = (i) => {
 
   let deps = [...union(fv, q.bnd), ...q.tmps.map(tmp => assignmentToSym[tmp] ? assignmentToSym[tmp] : tmpSym(tmp))] // XXX rhs dims only?
 
+  let rows = vectorized ? getVectorRows(q) : undefined
+  if (rows !== undefined) {
+    // the batches loop over the input themselves
+    let buf = []
+    c.comment(buf)("update " + sym + " = " + pretty(q) + " (vectorized)")
+    emitVectorizedUpdate(buf, q, tmpVar, rows)
+    assign(buf, sym, fv, [])
+    return
+  }
+
   // update
   let buf = []
   c.comment(buf)("update " + sym + " = " + pretty(q))
@@ -614,7 +1139,7 @@ let emitLoadInput = (buf, q) => {
     }
 
     let filenameStr
-    if (!isConstStr) {
+    if (!isConstStr && q.key != "param") {
       if (filename.cond) {
         c.if(buf)(filename.cond, buf1 => {
           c.printErr(buf1)("Attempting to open a file with undefined filename\\n")
@@ -626,6 +1151,7 @@ let emitLoadInput = (buf, q) => {
       c.declareCharArr(buf)(filenameStr, `${filename.val.len} + 1`)
       c.stmt(buf)(c.call("extract_str1", filename.val.str, filename.val.len, filenameStr))
     } else {
+      // constant strings and parameters are null-terminated
       filenameStr = filename.val.str
     }
 
@@ -638,50 +1164,65 @@ let emitLoadInput = (buf, q) => {
   filename = pretty(file)
 
   let isConstStr = file.key == "const" && typeof file.op == "string"
-  let buf1 = isConstStr ? prolog1 : buf
+  // parameters are known at startup, files named by them are loaded up front
+  let isStartupStr = isConstStr || file.key == "param"
+  // files with constant names are loaded once, also in server mode
+  let buf1 = isConstStr ? loadProlog : isStartupStr ? prolog1 : buf
 
   // If this is the first time we see this loadInput, load the file
   if (inputFiles[q.op]?.[filename] == undefined) {
     inputFiles[q.op] ??= {}
     let filenameStr = emitFilenameStr(buf1, file)
 
-    if (q.op == "json") {
+    if (q.op == "json" && streamJSON && typing.isNumber(q.schema.type.objKey)) {
+      // Top-level array of records: the elements are parsed one at a time
+      // by the generator loop instead of materializing the document
+      inputFiles[q.op][filename] = value.primitive(q.schema.type, { filename: filenameStr }, TAG.JSON_STREAM)
+    } else if (q.op == "json") {
       let jsonVal = json.emitLoadJSON(buf1, filenameStr)
       inputFiles[q.op][filename] = json.convertJSONTo(value.json(q.schema.type, jsonVal), q.schema.type)
+    } else if (q.op == "ndjson" && shredded) {
+      // Read the column files written by shredNDJSON instead of parsing the records
+      if (!isConstStr) throw new Error("Shredded inputs not supported on non-constant file names")
+      let cols = columnar.emitLoadColumns(buf1, file.op, shred.defaultColumnDir(file.op), q.schema.type)
+      inputFiles[q.op][filename] = value.primitive(q.schema.type, cols, TAG.COLUMNAR)
     } else if (q.op == "ndjson") {
       let { mappedFile, size } = json.emitLoadNDJSON(buf1, filenameStr)
 
       if (preload) {
-        if (!isConstStr) throw new Error("File preloading not supported on non-constant file names")
+        if (!isStartupStr) throw new Error("File preloading not supported on non-constant file names")
         let sym = symbol.getSymbol("preloaded")
 
         let cursor = symbol.getSymbol("i")
-        c.declareSize(prolog1)(cursor, "0")
-        let count = array.emitArrayInit(prolog1, sym)
-        c.stmt(prolog1)(c.assign(count, "0"))
+        c.declareSize(buf1)(cursor, "0")
+        let count = array.emitArrayInit(buf1, sym)
+        c.stmt(buf1)(c.assign(count, "0"))
         let arr = value.array(q.schema.type, sym, count)
         let doc = symbol.getSymbol("tmp_doc")
         let name = "_DEFAULT_"
         arr.val.values ??= {}
         arr.val.values[name] = { val: `${sym}_${name}`, schema: q.schema.type.objValue, tag: TAG.JSON }
 
-        array.allocateYYJSONBuffer(prolog1, `${sym}_${name}`)
-        prolog1.push(`while (${cursor} < ${size}) {`)
-        c.declarePtr(prolog1)("yyjson_doc", doc, c.call("yyjson_read_opts", c.add(mappedFile, cursor), c.sub(size, cursor), "YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE", "NULL", "NULL"))
+        array.allocateYYJSONBuffer(buf1, `${sym}_${name}`, undefined, false, undefined, count)
+        buf1.push(`while (${cursor} < ${size}) {`)
+        c.declarePtr(buf1)("yyjson_doc", doc, c.call("yyjson_read_opts", c.add(mappedFile, cursor), c.sub(size, cursor), "YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE", "NULL", "NULL"))
 
-        c.if(prolog1)(c.not(doc), buf2 => {
+        c.if(buf1)(c.not(doc), buf2 => {
           c.break(buf2)()
         })
 
-        c.stmt(prolog1)(c.assign(`${sym}_${name}[${count}]`, c.call("yyjson_doc_get_root", doc)))
-        c.stmt(prolog1)(c.inc(count))
+        c.stmt(buf1)(c.assign(`${sym}_${name}[${count}]`, c.call("yyjson_doc_get_root", doc)))
+        c.stmt(buf1)(c.inc(count))
 
-        c.stmt(prolog1)(c.assign(cursor, c.add(cursor, c.call("yyjson_doc_get_read_size", doc))))
+        c.stmt(buf1)(c.assign(cursor, c.add(cursor, c.call("yyjson_doc_get_read_size", doc))))
 
-        prolog1.push("}")
+        buf1.push("}")
         inputFiles[q.op][filename] = arr
       } else {
-        inputFiles[q.op][filename] = value.primitive(q.schema.type, { mappedFile, size }, TAG.NDJSON)
+        // the records of a resident file are parsed again for each request, so
+        // they cannot be parsed in place
+        let resident = serverMode && buf1 == loadProlog
+        inputFiles[q.op][filename] = value.primitive(q.schema.type, { mappedFile, size, resident }, TAG.NDJSON)
       }
 
     } else if (q.op == "csv" || q.op == "tbl") {
@@ -689,21 +1230,21 @@ let emitLoadInput = (buf, q) => {
       let fileValue = value.primitive(q.schema.type, { mappedFile, size, format: q.op }, TAG.CSV)
       if (preload) {
         // emit array
-        if (!isConstStr) throw new Error("File preloading not supported on non-constant file names")
+        if (!isStartupStr) throw new Error("File preloading not supported on non-constant file names")
         let sym = symbol.getSymbol("preloaded")
 
         let filter = { key: "get", arg: [q, { key: "var", op: "preload_iter" }], schema: { type: q.schema.type.objValue } }
         let getLoopTxtFunc = csv.getCSVLoopTxt(filter, fileValue, [], usedCols)
         let loopTxt = getLoopTxtFunc()
-        let count = array.emitArrayInit(prolog1, sym)
-        c.stmt(prolog1)(c.assign(count, "0"))
+        let count = array.emitArrayInit(buf1, sym)
+        c.stmt(buf1)(c.assign(count, "0"))
         let arr = value.array(q.schema.type, sym, count)
         let prefix = pretty(q)
         let val = {}
         for (let field of utils.convertToArrayOfSchema(q.schema.type.objValue)) {
           let { name, schema } = field
           if (usedCols[prefix]["preload_iter"][name]) {
-            array.emitArrayValueInit(prolog1, arr, name, schema)
+            array.emitArrayValueInit(buf1, arr, name, schema)
             let valName = mappedFile + "_preload_iter_" + name
             if (typing.isString(schema)) {
               let start = valName + "_start"
@@ -714,9 +1255,9 @@ let emitLoadInput = (buf, q) => {
             }
           }
         }
-        prolog1.push(...loopTxt.info, ...loopTxt.initCursor, ...loopTxt.loopHeader, ...loopTxt.rowScanning)
-        array.emitArrayInsert(prolog1, arr, { schema: q.schema.type.objValue, val, tag: TAG.OBJECT })
-        prolog1.push("}")
+        buf1.push(...loopTxt.info, ...loopTxt.initCursor, ...loopTxt.loopHeader, ...loopTxt.rowScanning)
+        array.emitArrayInsert(buf1, arr, { schema: q.schema.type.objValue, val, tag: TAG.OBJECT })
+        buf1.push("}")
         inputFiles[q.op][filename] = arr
       } else {
         inputFiles[q.op][filename] = fileValue
@@ -744,6 +1285,61 @@ let emitConst = (q) => {
   }
 }
 
+let paramParsers = {
+  [typeSyms.boolean]: "parse_param_bool",
+  [typeSyms.u8]: "parse_param_uint",
+  [typeSyms.u16]: "parse_param_uint",
+  [typeSyms.u32]: "parse_param_uint",
+  [typeSyms.u64]: "parse_param_uint",
+  [typeSyms.i8]: "parse_param_int",
+  [typeSyms.i16]: "parse_param_int",
+  [typeSyms.i32]: "parse_param_int",
+  [typeSyms.i64]: "parse_param_int",
+  [typeSyms.f32]: "parse_param_double",
+  [typeSyms.f64]: "parse_param_double",
+  [typeSyms.date]: "parse_param_date",
+}
+
+// Query parameters are parsed once at startup, so the same binary
+// can be run with different values
+let emitParam = (q) => {
+  if (params[q.op] !== undefined) return params[q.op].val
+
+  let schema = q.schema.type
+  let sym = symbol.getSymbol("param")
+  let name = JSON.stringify(q.op)
+  let arg = sym + "_arg"
+  c.declareConstCharPtr(prolog1)(arg, c.call("param_arg", "argc", "argv", String(Object.keys(params).length + 1), name))
+
+  let val
+  if (typing.isString(schema)) {
+    let len = sym + "_len"
+    c.declareInt(prolog1)(len, c.call("strlen", arg))
+    val = value.string(schema, arg, len)
+    if (q.maxLength !== undefined) {
+      c.if(prolog1)(c.gt(len, String(q.maxLength)), buf1 => {
+        c.printErr(buf1)(`Query parameter %s is longer than %d bytes\\n`, name, String(q.maxLength))
+        c.return(buf1)("1")
+      })
+      // Precompute the word used in the short string comparisons
+      if (q.maxLength <= 8) {
+        val.val.word = sym + "_word"
+        val.val.mask = sym + "_mask"
+        c.declareVar(prolog1)("uint64_t", val.val.word, c.call("str_word", arg, len))
+        c.declareVar(prolog1)("uint64_t", val.val.mask, c.call("str_mask", len))
+      }
+    }
+  } else if (paramParsers[schema.typeSym]) {
+    c.declareVar(prolog1)(utils.convertToCType(schema), sym, c.call(paramParsers[schema.typeSym], arg, name))
+    val = value.primitive(schema, sym)
+  } else {
+    throw new Error("Query parameter type not supported: " + typing.prettyPrintType(schema))
+  }
+
+  params[q.op] = { index: Object.keys(params).length + 1, val }
+  return val
+}
+
 let emitGet = (buf, q) => {
   let [e1, e2] = q.arg
 
@@ -770,8 +1366,10 @@ let emitGet = (buf, q) => {
         }
       })
       return { schema: q.schema.type, val, tag: TAG.OBJECT }
-    } else if (g1.tag == TAG.NDJSON) {
+    } else if (g1.tag == TAG.NDJSON || g1.tag == TAG.JSON_STREAM) {
       return vars[e2.op].gen[pretty(e1)]
+    } else if (g1.tag == TAG.COLUMNAR) {
+      return columnar.getRecordAtIdx(g1.schema.objValue, g1.val.columns, quoteVar(e2.op))
     } else if (g1.tag == TAG.JSON) {
       if (pretty(e1) == Object.keys(vars[e2.op].lhs)[0]) {
         // It's better if we do not perform generic get since we should have the iterator ready for the loop,
@@ -803,9 +1401,13 @@ let emitGet = (buf, q) => {
   // If we are not getting a var, get the lhs first
   let v1 = emitPath(buf, e1)
 
+  if (v1.tag == TAG.JSON_STREAM) {
+    throw new Error("Streamed JSON arrays can only be accessed through a generator: " + pretty(q))
+  }
+
   if (v1.tag == TAG.JSON) {
     let key = emitPath(buf, e2)
-    let res = { schema: q.schema.type, tag: TAG.JSON }
+    let res = { schema: q.schema.type, tag: TAG.JSON, transient: v1.transient }
 
     // Assume string key now
     let get = symbol.getSymbol("tmp_get")
@@ -848,6 +1450,7 @@ let emitGet = (buf, q) => {
 
   let cond = v1.cond
   if (!v1.val[e2.op]) cond = "1"
+  else if (v1.val[e2.op].cond) cond = cond ? c.or(cond, v1.val[e2.op].cond) : v1.val[e2.op].cond
   return { ...v1.val[e2.op], cond }
 }
 
@@ -862,6 +1465,7 @@ let emitOrElse = (buf, q) => {
       c.declareConstCharPtr(buf)(tmpStr, c.ternary(cond, e2.val.str, e1.val.str))
       c.declareInt(buf)(tmpLen, c.ternary(cond, e2.val.len, e1.val.len))
       res.val = { str: tmpStr, len: tmpLen }
+      if (e1.transient || e2.transient) res.transient = true
     } else if (e2.schema.typeSym == typeSyms.boolean) {
       res.val = "1"
     } else {
@@ -972,7 +1576,9 @@ let emitPure = (buf, q) => {
     console.assert(typing.isString(e1.schema))
     let str = c.add(e1.val.str, e2.val)
     let len = c.sub(e3.val, e2.val)
-    return value.string(q.schema.type, str, len, undefined, e1.cond)
+    let res = value.string(q.schema.type, str, len, undefined, e1.cond)
+    if (e1.transient) res.transient = true
+    return res
   } else if (q.op == "like") {
     if (q.arg[1].key != "const" || typeof q.arg[1].key != "string") {
       throw new Error("Only support constant string regex")
@@ -1025,15 +1631,24 @@ let emitPure = (buf, q) => {
       if (typing.isString(e1.schema) && typing.isString(e2.schema)) {
         let { str: str1, len: len1 } = e1.val
         let { str: str2, len: len2 } = e2.val
-        if ((q.op == "equal" || q.op == "notEqual") && ((q.arg[0].key == "const" && q.arg[0].op.length <= 8) || (q.arg[1].key == "const" && q.arg[1].op.length <= 8))) {
+        // word and mask of a constant string or a short string parameter
+        let shortStr = (q1, e) => {
+          if (q1.key == "const" && q1.op.length <= 8)
+            return { word: utils.stringToHexBytes(q1.op), mask: "0x" + "00".repeat(8 - q1.op.length) + "FF".repeat(q1.op.length) }
+          if (q1.key == "param" && e.val.word)
+            return { word: e.val.word, mask: e.val.mask }
+        }
+        let short1 = shortStr(q.arg[0], e1)
+        let short2 = shortStr(q.arg[1], e2)
+        if ((q.op == "equal" || q.op == "notEqual") && (short1 || short2)) {
           let lhs
           let rhs
-          if (q.arg[0].key == "const") {
-            lhs = utils.stringToHexBytes(q.arg[0].op)
-            rhs = "(*(" + c.cast("uint64_t *", str1) + ") & 0x" + "00".repeat(8 - q.arg[0].op.length) + "FF".repeat(q.arg[0].op.length) + ")"
+          if (short1) {
+            lhs = short1.word
+            rhs = "(*(" + c.cast("uint64_t *", str2) + ") & " + short1.mask + ")"
           } else {
-            lhs = "(*(" + c.cast("uint64_t *", str1) + ") & 0x" + "00".repeat(8 - q.arg[1].op.length) + "FF".repeat(q.arg[1].op.length) + ")"
-            rhs = utils.stringToHexBytes(q.arg[1].op)
+            lhs = "(*(" + c.cast("uint64_t *", str1) + ") & " + short2.mask + ")"
+            rhs = short2.word
           }
           if (q.op == "equal") {
             res = value.primitive(q.schema.type, c.ternary(c.eq(len1, len2), c.eq(lhs, rhs), "0"))
@@ -1130,6 +1745,8 @@ let emitPath = (buf, q) => {
     return emitLoadInput(buf, q)
   } else if (q.key == "const") {
     return emitConst(q)
+  } else if (q.key == "param") {
+    return emitParam(q)
   } else if (q.key == "var") {
     return vars[q.op].val
   } else if (q.key == "ref") {
@@ -1447,6 +2064,43 @@ let collectNestedHashMap = (q, map, name, currentGroupPath) => {
   c.declareStruct(prolog0)(struct)
 }
 
+// Statistics of <file>.*A.<column> from the catalog
+let getColumnStats = (q) => {
+  q = stripConverts(q)
+  if (q.key != "get" || q.arg[1].key != "const") return
+  let e = q.arg[0]
+  if (e.key != "get" || e.arg[0].key != "loadInput" || e.arg[1].key != "var") return
+  let file = e.arg[0].arg[0]
+  if (file.key != "const" || typeof file.op != "string") return
+  let stats = catalog.lookup(catalogEntries, file.op)
+  let column = stats?.columns[q.arg[1].op]
+  if (column) return { file: file.op, rows: stats.rows, column }
+}
+
+// Estimate the number of keys of a mkset from the distinct values of the
+// key columns, undefined if a column was not analyzed
+let estimateKeyCount = (mksetVal) => {
+  let keys = mksetVal.key == "pure" && mksetVal.op == "combine" ? mksetVal.arg : [mksetVal]
+  let stats = keys.map(getColumnStats)
+  if (stats.some(s => s === undefined)) return
+  let estimate = stats.reduce((acc, s) => acc * s.column.distinct, 1)
+  // combinations of columns of one file are bounded by its rows
+  if (stats.every(s => s.file == stats[0].file)) estimate = Math.min(estimate, stats[0].rows)
+  return estimate
+}
+
+// Integer keys of a single analyzed column, the range [min, max] of the
+// catalog. Within a table of at least that many slots each key has its
+// own slot and no probing or key comparison is needed.
+let getDenseKey = (mksetVal) => {
+  if (!typing.isInteger(mksetVal.schema.type)) return
+  let stats = getColumnStats(mksetVal)
+  if (stats === undefined) return
+  let { min, max } = stats.column
+  if (!Number.isSafeInteger(min) || !Number.isSafeInteger(max)) return
+  return { min, range: max - min + 1 }
+}
+
 // Collect hashmaps required for the query
 let collectHashMap = (q) => {
   let i = q.op
@@ -1463,6 +2117,8 @@ let collectHashMap = (q) => {
   }
 
   let keySchema = [e1.schema.type]
+  let estimate
+  let dense
 
   // If there is a mkset
   if (e3) {
@@ -1473,12 +2129,31 @@ let collectHashMap = (q) => {
     } else {
       keySchema = [mksetVal.schema.type]
     }
+    estimate = estimateKeyCount(mksetVal)
+    if (estimate !== undefined) keyEstimates[sym] = estimate
+    if (!catalogSizing) estimate = undefined
+    dense = getDenseKey(mksetVal)
     collectHashMapsInPath(e3)
   }
+  // a partitioned group-by holds at most the groups that fit its budget
+  let partitioned = getPartitioned(i)
+  if (partitioned) estimate = partitioned.maxGroups
+  // a streaming one only the group of the current run
+  if (streamGroup?.i == i) estimate = 1
 
   // Create hashmap
-  let { htable, count, keys } = hashmap.emitHashMapInit(prolog1, i, keySchema)
+  let { htable, count, keys, capacity } = hashmap.emitHashMapInit(prolog1, i, keySchema, estimate)
   let tmpVar = value.hashmap(q.schema.type, i, htable, count, keys)
+  tmpVar.val.capacity = capacity
+  if (dense && dense.range <= capacity && !partitioned && spillGroup?.i != i && streamGroup?.i != i && !mergeJoins[i])
+    tmpVar.val.denseMin = dense.min
+  if (partitioned) tmpVar.val.spillLimit = partitioned.maxGroups
+  if (spillGroup?.i == i) tmpVar.val.spillFlush = spillGroup.flush
+  if (streamGroup?.i == i) tmpVar.val.flushRun = streamGroup.flush
+  if (mergeJoins[i]) {
+    tmpVar.val.mergeCursor = `${sym}_merge_pos`
+    c.declareInt(prolog1)(tmpVar.val.mergeCursor, "1")
+  }
   tmpVars[i] = tmpVar
 
   let keyList = [e1]
@@ -1516,6 +2191,442 @@ let collectHashMap = (q) => {
 
 }
 
+// Spilling aggregation (settings.groupMemory, bytes): if the groups of the
+// top-level group-by do not fit the budget, the partial aggregates of all
+// groups are written to hash partition files and the table is emptied (see
+// spill_groups in rhyme-c.h). The input is scanned once. After the loops each
+// file is merged on its own and its groups are printed, a file whose groups
+// do not fit either is spilled again.
+//
+// Only group-bys whose values are aggregates with a merge (spillCombine) are
+// spilled, and no other state may be updated by the loops.
+let cTypeSize = {
+  int: 4, char: 1, float: 4, double: 8,
+  uint8_t: 1, uint16_t: 2, uint32_t: 4, uint64_t: 8,
+  int8_t: 1, int16_t: 2, int32_t: 4, int64_t: 8
+}
+
+// Assignments that compute the group-by i and its values, undefined unless
+// the values are aggregates that read no other tmps than the ones in inputs
+let getGroupAggregates = (i, inputs = new Set()) => {
+  let q1 = assignments[i]
+  if (q1.key != "update" || q1.fre.length > 0) return
+  let [e0, e1, e2, e3] = q1.arg
+  if (e0.key != "const" || e1.key != "var" || !e3) return
+
+  let owned = new Set([String(i)])
+  let simple = true
+  let visit = e => {
+    if (e.key == "ref") {
+      let a = assignments[e.op]
+      // the groups of a count-distinct or sketch are the addresses of their
+      // results, which are reused across passes and runs
+      if (a.key != "stateful" || a.op == "countDistinct" || approxOps.includes(a.op) || a.tmps.some(t => !inputs.has(String(t)))) simple = false
+      owned.add(String(e.op))
+    } else {
+      e.arg?.forEach(visit)
+    }
+  }
+  visit(e2)
+  if (simple) return owned
+}
+
+// Bytes per group: keys, values with their defined flags and the hash table
+// slots (at a load factor of at most 1/4). Undefined for values other than
+// numbers and strings.
+let getGroupSize = (q1) => {
+  let mksetVal = q1.arg[3].arg[0].arg[0]
+  let keySchemas = mksetVal.key == "pure" && mksetVal.op == "combine" ? mksetVal.arg.map(e => e.schema.type) : [mksetVal.schema.type]
+  let valueSchema = q1.schema.type.objValue
+  let valueSchemas = typing.isObject(valueSchema) ? utils.convertToArrayOfSchema(valueSchema).map(f => f.schema) : [valueSchema]
+  let schemas = [...keySchemas, ...valueSchemas]
+  if (schemas.some(schema => !typing.isString(schema) && !(utils.convertToCType(schema) in cTypeSize))) return
+  return schemas.reduce((acc, schema) =>
+    acc + (typing.isString(schema) ? 12 : cTypeSize[utils.convertToCType(schema)] + 1), 16)
+}
+
+// How two partial aggregates of a group are merged, by op
+let spillCombine = { sum: "+", count: "+", product: "*", min: "min", max: "max", first: "first", single: "first" }
+
+// Ops of the values of the group-by i by name, undefined unless each value
+// is a stateful op
+let getGroupFields = (i) => {
+  let e2 = assignments[i].arg[2]
+  let vals = e2.key == "pure" && e2.op == "mkTuple" ?
+    Object.fromEntries(e2.arg.flatMap((e, j) => j % 2 == 0 ? [[e.op, e2.arg[j + 1]]] : [])) : { _DEFAULT_: e2 }
+  let fields = {}
+  for (let name in vals) {
+    let e = stripConverts(vals[name])
+    if (e.key != "ref" || assignments[e.op].key != "stateful") return
+    fields[name] = assignments[e.op]
+  }
+  return fields
+}
+
+let getSpillGroup = (q, settings) => {
+  if (!(settings.groupMemory > 0) || serverMode || settings.limit || settings.format != "json") return
+  if (q.key != "ref") return
+
+  // the values are aggregates of the group, nothing else is computed
+  let owned = getGroupAggregates(q.op)
+  if (!owned || Object.keys(assignments).some(j => !owned.has(j))) return
+  let fields = getGroupFields(q.op)
+  if (!fields || Object.values(fields).some(q1 => !(q1.op in spillCombine) ||
+    typing.isString(q1.schema.type) && spillCombine[q1.op] != "first")) return
+  let size = getGroupSize(assignments[q.op])
+  if (!size) return
+
+  let maxGroups = Math.max(1, Math.floor(settings.groupMemory / size))
+  // a full table is spilled before the next group is inserted
+  let flush = (buf) => {
+    let map = tmpVars[q.op]
+    emitSpillFlush(buf, map)
+    emitSpillClear(buf, map)
+  }
+  return { i: q.op, maxGroups, fields, flush }
+}
+
+// Append the groups of the hashmap to the files of their partitions
+let emitSpillFlush = (buf, map) => {
+  buf.push(`for (int key_pos = 1; key_pos <= ${map.val.count}; key_pos++) {`)
+  let keys = map.val.keys.map(key => typing.isString(key.schema) ?
+    value.string(key.schema, `${key.val.str}[key_pos]`, `${key.val.len}[key_pos]`) :
+    value.primitive(key.schema, `${key.val}[key_pos]`))
+  let key = keys.length == 1 ? keys[0] : value.combinedKey(keys.map(k => k.schema), keys)
+  let f = symbol.getSymbol("spill_file")
+  c.declarePtr(buf)("FILE", f, c.call("spill_file", "&spill", hashmap.hash(buf, key)))
+  for (let key of keys) {
+    if (typing.isString(key.schema)) c.stmt(buf)(c.call("spill_write_str", f, key.val.str, key.val.len))
+    else c.stmt(buf)(c.call("fwrite", "&" + key.val, `sizeof(${key.val})`, "1", f))
+  }
+  for (let name in map.val.values) {
+    let { schema, val, defined } = map.val.values[name]
+    if (defined) c.stmt(buf)(c.call("fwrite", `&${defined}[key_pos]`, "1", "1", f))
+    if (typing.isString(schema)) {
+      // an undefined string is written empty
+      let len = defined ? c.ternary(`${defined}[key_pos]`, `${val.len}[key_pos]`, "0") : `${val.len}[key_pos]`
+      c.stmt(buf)(c.call("spill_write_str", f, `${val.str}[key_pos]`, len))
+    } else {
+      c.stmt(buf)(c.call("fwrite", `&${val}[key_pos]`, `sizeof(${val}[0])`, "1", f))
+    }
+  }
+  buf.push("}")
+}
+
+// Empty the hashmap, its values are initialized on insert
+let emitSpillClear = (buf, map) => {
+  c.stmt(buf)(c.assign(map.val.count, "0"))
+  c.stmt(buf)(c.call("memset", map.val.htable, "0", `sizeof(int) * ${map.val.capacity}`))
+  for (let name in map.val.values) {
+    let defined = map.val.values[name].defined
+    if (defined) c.stmt(buf)(c.call("memset", defined, "0", `sizeof(uint8_t) * ${map.val.capacity}`))
+  }
+}
+
+// Read a key or value of a spilled group
+let emitSpillRead = (buf, schema) => {
+  if (typing.isString(schema)) {
+    let str = symbol.getSymbol("spill_str")
+    let len = symbol.getSymbol("spill_len")
+    c.declareInt(buf)(len)
+    c.declareConstCharPtr(buf)(str, c.call("spill_read_str", "&spill", "&" + len))
+    return value.string(schema, str, len)
+  }
+  let val = symbol.getSymbol("spill_val")
+  c.declareVar(buf)(utils.convertToCType(schema), val)
+  c.stmt(buf)(c.call("spill_read", "&spill", "&" + val, `sizeof(${val})`))
+  return value.primitive(schema, val)
+}
+
+// Merge the partial aggregate rec of a spilled group into lhs
+let emitSpillCombine = (buf, q1, lhs, rec) => {
+  let combine = spillCombine[q1.op]
+  let merge = (buf1) => {
+    if (combine == "+" || combine == "*") {
+      c.stmt(buf1)(c.assign(lhs.val, c.binary(lhs.val, rec.val, combine)))
+    } else if (combine == "min" || combine == "max") {
+      let op = combine == "min" ? "<" : ">"
+      c.stmt(buf1)(`${lhs.val} = ${rec.val} ${op} ${lhs.val} ? ${rec.val} : ${lhs.val}`)
+    }
+  }
+  // values without a defined flag are initialized on insert
+  if (!lhs.defined) return merge(buf)
+  c.if(buf)(rec.defined, buf1 => {
+    c.if(buf1)(c.not(lhs.defined), buf2 => {
+      c.stmt(buf2)(c.assign(lhs.defined, "1"))
+      if (typing.isString(lhs.schema)) {
+        c.stmt(buf2)(c.assign(lhs.val.str, rec.val.str))
+        c.stmt(buf2)(c.assign(lhs.val.len, rec.val.len))
+      } else {
+        c.stmt(buf2)(c.assign(lhs.val, rec.val))
+      }
+    }, combine == "first" ? undefined : merge)
+  })
+}
+
+// Merge the groups of the spilled file being read into the hashmap
+let emitSpillMerge = (buf, map) => {
+  c.while(buf)(c.lt("spill.pos", "spill.size"), buf1 => {
+    let keys = map.val.keys.map(key => emitSpillRead(buf1, key.schema))
+    let key = keys.length == 1 ? keys[0] : value.combinedKey(keys.map(k => k.schema), keys)
+    let recs = {}
+    for (let name in map.val.values) {
+      let { schema, defined } = map.val.values[name]
+      let recDefined
+      if (defined) {
+        recDefined = symbol.getSymbol("spill_defined")
+        c.declareVar(buf1)("uint8_t", recDefined)
+        c.stmt(buf1)(c.call("spill_read", "&spill", "&" + recDefined, "1"))
+      }
+      recs[name] = { ...emitSpillRead(buf1, schema), defined: recDefined }
+    }
+    let at = (name, keyPos) => {
+      let { schema, val, defined } = map.val.values[name]
+      let idx = `[${keyPos}]`
+      return {
+        schema, defined: defined && defined + idx,
+        val: typing.isString(schema) ? { str: val.str + idx, len: val.len + idx } : val + idx
+      }
+    }
+    hashmap.emitHashLookUpAndUpdateCust(buf1, map, key, (buf2, lhs, pos, keyPos) => {
+      for (let name in spillGroup.fields) {
+        if (!map.val.values[name].defined) emitStatefulInit(buf2, spillGroup.fields[name], at(name, keyPos))
+      }
+    }, (buf2, lhs, pos, keyPos) => {
+      for (let name in spillGroup.fields) emitSpillCombine(buf2, spillGroup.fields[name], at(name, keyPos), recs[name])
+    }, true)
+  })
+}
+
+// Radix-partitioned join: a group-by over the rows of a build input that is
+// only used through lookups by a key of one probe input is built and probed
+// one hash partition at a time, so that its table stays cache-sized. A first pass scans both inputs and keeps the key hash
+// and position of each row in the bucket of its partition (radix_parts in
+// rhyme-c.h), each following pass reads the rows of one partition only.
+//
+// It is chosen when the estimated keys of the build side (see the catalog)
+// reach settings.radixJoinThreshold, radixJoin: true forces and false
+// disables it. The number of partitions follows from the estimate and
+// settings.joinPartitionBytes. The result has to be a group-by of aggregates
+// over the probe rows, which are each seen in exactly one pass.
+let getRadixJoin = (q, settings) => {
+  if (settings.radixJoin === false || serverMode || preload || q.key != "ref") return
+  for (let b in assignments) {
+    if (b == String(q.op) || mergeJoins[b]) continue
+    let build = getGroupAggregates(b)
+    let probe = build && getGroupAggregates(q.op, build)
+    if (!probe || Object.keys(assignments).some(j => !build.has(j) && !probe.has(j))) continue
+
+    // the build side is looked up by a single key of one probe generator
+    let probeKeys = getProbeKeys(b, [...probe].map(j => assignments[j]))
+    if (probeKeys.length != 1) continue
+    let probeKey = probeKeys[0]
+    let probeVar = getRowVar(probeKey)
+    let q1 = assignments[b]
+    let buildKey = q1.arg[3].arg[0].arg[0]
+    let buildVar = getRowVar(buildKey)
+    if (!probeVar || !buildVar || probeVar == buildVar) continue
+    // the aggregates of each side run over its rows, the build side is not
+    // iterated
+    let over = (v, j) => assignments[j].bnd.includes(v) || assignments[j].fre.includes(v)
+    if ([...probe].some(j => j != String(q.op) && !over(probeVar, j))) continue
+    if ([...build].some(j => j != b && !over(buildVar, j))) continue
+    if (filters.some(f => f.arg[0].key == "ref" && String(f.arg[0].op) == b)) continue
+
+    let size = getGroupSize(q1)
+    if (!size) continue
+    let estimate = estimateKeyCount(buildKey)
+    if (settings.radixJoin !== true && !(estimate >= (settings.radixJoinThreshold ?? 1 << 20))) continue
+    estimate ??= hashSize
+
+    let partitionBytes = settings.joinPartitionBytes ?? 1 << 18
+    let bits = Math.min(Math.max(Math.ceil(Math.log2(estimate * size / partitionBytes)), 1), 12)
+    // room for skew, a partition that does not fit is split
+    let maxGroups = Math.ceil(estimate / (1 << bits) * 2)
+    return { i: b, buildVar, buildKey, probeVar, probeKey, bits, maxGroups }
+  }
+}
+
+// Keys the group-by b is looked up with in the expressions es
+let getProbeKeys = (b, es) => {
+  let keys = {}
+  let visit = e => {
+    if (e.key == "get" && e.arg[0].key == "ref" && String(e.arg[0].op) == b) keys[pretty(e.arg[1])] = e.arg[1]
+    e.arg?.forEach(visit)
+  }
+  es.forEach(visit)
+  return Object.values(keys)
+}
+
+// Merge join: a group-by over an input sorted on its key that is looked up
+// by keys of an input sorted the same way. Its keys are inserted in
+// ascending order and each lookup moves a cursor forward over them instead
+// of hashing (see emitHashLookUp), so both inputs are merged in key order.
+// Sort order is declared as for the streaming group-by (see isSortedColumn)
+// and has to be ascending, a build key out of order fails at runtime.
+let getMergeJoins = (q, settings) => {
+  let res = {}
+  for (let b in assignments) {
+    let q1 = assignments[b]
+    if (q1.key != "update" || q1.fre.length > 0 || !q1.arg[3]) continue
+    if (b == String(streamGroup?.i) || b == String(spillGroup?.i)) continue
+    if (!isSortedColumn(q1.arg[3].arg[0].arg[0], settings)) continue
+    // entries accessed through a generator variable are not looked up
+    let probeKeys = getProbeKeys(b, [...Object.values(assignments), q]).filter(k => k.key != "var")
+    if (probeKeys.length > 0 && probeKeys.every(k => isSortedColumn(k, settings))) res[b] = true
+  }
+  return res
+}
+
+// Streaming aggregation: if the key of the top-level group-by is a column
+// whose values are sorted, the rows of each group are contiguous. The group
+// of the current run is the only entry of its hashmap, it is printed and
+// dropped when the key changes, so no hashing is needed and the memory does
+// not grow with the number of groups. A column is sorted if it is declared
+// in settings.sortedInputs, e.g. { "lineitem.tbl": ["l_orderkey"] }, or with
+// settings.catalogSortOrder if the catalog found it sorted (see analyze).
+// The catalog only describes the file as analyzed, so its order is not
+// relied on without that opt-in.
+//
+// All aggregates have to run over the rows of the input of the key.
+let isSortedColumn = (q, settings) => {
+  q = stripConverts(q)
+  if (q.key != "get" || q.arg[1].key != "const") return false
+  let e = q.arg[0]
+  if (e.key != "get" || e.arg[0].key != "loadInput" || e.arg[1].key != "var") return false
+  let file = e.arg[0].arg[0]
+  if (file.key != "const" || typeof file.op != "string") return false
+  let column = q.arg[1].op
+  if (settings.sortedInputs?.[file.op]?.includes(column)) return true
+  return settings.catalogSortOrder === true && getColumnStats(q)?.column.sorted === true
+}
+
+// Variables of the row generator of the input and of the generators nested
+// in its rows, undefined if a generator iterates over anything else
+let getRowGenerators = (rowVar, input, keyVar) => {
+  let rowVars = [rowVar]
+  let others = []
+  for (let f of filters) {
+    let v = f.arg[1].op
+    if (v == keyVar) continue
+    if (v == rowVar) {
+      let gen = f.arg[0]
+      if (gen.key != "loadInput" || gen.op != input.op || gen.arg[0].op !== input.arg[0].op) return
+      continue
+    }
+    let vs = []
+    let visit = e => {
+      if (e.key == "var" && !vs.includes(e.op)) vs.push(e.op)
+      e.arg?.forEach(visit)
+    }
+    visit(f.arg[0])
+    others.push({ v, vs })
+  }
+  // nested generators can depend on each other, add them until none is left
+  while (others.length > 0) {
+    let i = others.findIndex(({ vs }) => vs.length > 0 && vs.every(v => rowVars.includes(v)))
+    if (i < 0) return
+    rowVars.push(others[i].v)
+    others.splice(i, 1)
+  }
+  return rowVars
+}
+
+let getStreamGroup = (q, settings) => {
+  if (serverMode || settings.limit || settings.format != "json" || q.key != "ref") return
+
+  let owned = getGroupAggregates(q.op)
+  if (!owned || Object.keys(assignments).some(j => !owned.has(j))) return
+  let q1 = assignments[q.op]
+  let mksetVal = q1.arg[3].arg[0].arg[0]
+  if (!isSortedColumn(mksetVal, settings)) return
+
+  // the input rows and the key are the only generators
+  let rowVar = stripConverts(mksetVal).arg[0].arg[1].op
+  let input = stripConverts(mksetVal).arg[0].arg[0]
+  if (!["csv", "tbl", "ndjson"].includes(input.op)) return
+  let keyVar = q1.arg[1].op
+  // other generators may only iterate within a row (e.g. over an array of
+  // an NDJSON record), the rows of a group are then still contiguous
+  let rowVars = getRowGenerators(rowVar, input, keyVar)
+  if (!rowVars) return
+  if ([...owned].some(j => j != String(q.op) &&
+    (assignments[j].bnd.some(v => !rowVars.includes(v)) || assignments[j].fre.some(v => v != keyVar)))) return
+
+  // print the group of the run that ended
+  let flush = (buf) => {
+    let map = tmpVars[q.op]
+    printEmitter.emitHashMapPartPrintJSON(buf, map, settings, "run_printed")
+    for (let name in map.val.values) {
+      let defined = map.val.values[name].defined
+      if (defined) c.stmt(buf)(c.assign(`${defined}[1]`, "0"))
+    }
+  }
+  return { i: q.op, keyVar, flush }
+}
+
+// Group-by whose groups are limited to a budget, if any
+let getPartitioned = (i) => [spillGroup, radixJoin].find(p => p && String(p.i) == String(i))
+
+// Row variable of a join key, if the key reads a single CSV input
+let getRowVar = (key) => {
+  let vs = []
+  let visit = e => {
+    if (e.key == "var" && !vs.includes(e.op)) vs.push(e.op)
+    e.arg?.forEach(visit)
+  }
+  visit(key)
+  if (vs.length != 1) return
+  let gens = filters.filter(f => f.arg[1].op == vs[0])
+  if (gens.length != 1) return
+  let input = gens[0].arg[0]
+  if (input.key != "loadInput" || !["csv", "tbl"].includes(input.op)) return
+  return vs[0]
+}
+
+// Loop over the rows of an input of a radix join (side 0 is the build side,
+// 1 the probe side). The first pass scans the input and adds each row to the
+// bucket of the hash of its key, the others read the rows of the bucket of
+// their partition at the offsets recorded.
+let addRadixRows = (e, file, v, side, keyExpr) => {
+  let getLoopTxt = e.getLoopTxt
+  v = quoteVar(v)
+  e.getLoopTxt = () => {
+    let loopTxt = getLoopTxt()
+    let { cursor } = loopTxt
+    let bucket = `radix.cur.side[${side}]`
+    let k = symbol.getSymbol("radix_k")
+    let start = symbol.getSymbol("radix_start")
+    let loopHeader = [`for (size_t ${v} = 0, ${k} = 0; radix.partitioning ? ${cursor} < ${file.val.size} : ${k} < ${bucket}.len; ${v}++, ${k}++) {`]
+    let seek = []
+    c.if(seek)(c.not("radix.partitioning"), buf1 => {
+      c.stmt(buf1)(c.assign(v, `${bucket}.rows[${k}].row`))
+      c.stmt(buf1)(c.assign(cursor, `${bucket}.rows[${k}].offset`))
+    })
+    c.declareSize(seek)(start, cursor)
+    let partition = []
+    c.if(partition)("radix.partitioning", buf1 => {
+      let key = emitPath(buf1, keyExpr)
+      c.stmt(buf1)(c.call("radix_add", "&radix", side, hashmap.hash(buf1, key), v, start))
+      c.continue(buf1)()
+    })
+    return { ...loopTxt, loopHeader, rowScanning: [...seek, ...loopTxt.rowScanning, ...partition] }
+  }
+}
+
+// Start of a pass: the hashmap is emptied, its values are initialized on insert
+let emitRadixPassStart = (buf, map, bits) => {
+  c.declareVar(buf)("radix_parts", "radix")
+  c.stmt(buf)(c.call("radix_init", "&radix", bits))
+  buf.push(`while (radix_next(&radix)) {`)
+  c.stmt(buf)(c.assign(map.val.count, "0"))
+  c.stmt(buf)(c.call("memset", map.val.htable, "0", `sizeof(int) * ${map.val.capacity}`))
+  for (let name in map.val.values) {
+    let defined = map.val.values[name].defined
+    if (defined) c.stmt(buf)(c.call("memset", defined, "0", `sizeof(uint8_t) * ${map.val.capacity}`))
+  }
+}
+
 // Collect hashmaps required for the query
 let collectHashMapsInPath = q => {
   if (q.key == "ref" && assignments[q.op].key == "update") {
@@ -1598,11 +2709,21 @@ let processFilters = () => {
       if (lhs.tag == TAG.CSV) {
         let getLoopTxtFunc = csv.getCSVLoopTxt(f, lhs, data, usedCols)
         addGenerator(f.arg[0], f.arg[1], getLoopTxtFunc)
+        if (radixJoin?.buildVar == v1) addRadixRows(generatorStms[generatorStms.length - 1], lhs, v1, 0, radixJoin.buildKey)
+        if (radixJoin?.probeVar == v1) addRadixRows(generatorStms[generatorStms.length - 1], lhs, v1, 1, radixJoin.probeKey)
       } else if (lhs.tag == TAG.NDJSON) {
         let getLoopTxtFunc = json.getNDJSONLoopTxt(f, lhs, data)
         vars[v1].gen ??= {}
         vars[v1].gen[pretty(g1)] = value.json(schema.objValue, quoteVar(v1) + "_gen")
         addGenerator(f.arg[0], f.arg[1], getLoopTxtFunc)
+      } else if (lhs.tag == TAG.COLUMNAR) {
+        let getLoopTxtFunc = columnar.getColumnarLoopTxt(f, lhs, data)
+        addGenerator(f.arg[0], f.arg[1], getLoopTxtFunc)
+      } else if (lhs.tag == TAG.JSON_STREAM) {
+        let getLoopTxtFunc = json.getJSONStreamLoopTxt(f, lhs, data, streamBufferSize)
+        vars[v1].gen ??= {}
+        vars[v1].gen[pretty(g1)] = { ...value.json(schema.objValue, quoteVar(v1) + "_gen"), transient: true }
+        addGenerator(f.arg[0], f.arg[1], getLoopTxtFunc)
       } else if (lhs.tag == TAG.JSON) {
         if (typing.isNumber(schema.objKey)) {
           let getLoopTxtFunc = json.getJSONArrayLoopTxt(f, lhs, data)
@@ -1647,10 +2768,33 @@ let emitGetTime = (buf) => {
   let time = symbol.getSymbol("t")
   c.declareLong(buf)(time, c.add(c.mul(`${timeval}.tv_sec`, "1000000L"), `${timeval}.tv_usec`))
 
+  // hardware counters at the same point, see perfSample
+  if (perfCounters) {
+    c.stmt(buf)(`perf_sample ${perfSample(time)}`)
+    c.stmt(buf)(c.call("perf_read", "&" + perfSample(time)))
+  }
+
   return time
 }
 
-let emitCode = (q, ir, settings) => {
+let perfSample = (time) => "perf_" + time
+
+// Count the rows that pass each generator of a loop (the first one is
+// the number of rows scanned). A key with a condition is a filter.
+let instrumentGenerators = () => {
+  generatorStms.forEach((e, i) => {
+    let rows = e.filter ? instrument.counter("filter", i, "passed", e.label) : instrument.counter("generator", i, "rows", e.label)
+    if (rows === undefined) return
+    let getLoopTxt = e.getLoopTxt
+    e.getLoopTxt = () => {
+      let loopTxt = getLoopTxt()
+      return { ...loopTxt, rowScanning: [...loopTxt.rowScanning, c.inc(rows) + ";"] }
+    }
+  })
+}
+
+// files: where the binary writes its reports (instrument, memory, counts)
+let emitCode = (q, ir, settings, files) => {
   reset(settings)
 
   filters = ir.filters
@@ -1658,11 +2802,18 @@ let emitCode = (q, ir, settings) => {
 
   // Fill with default prolog
   initializeProlog()
+  instrument.emitPhaseStart(loadProlog, "load")
 
   // Get the used filters to optimize CSV reading
   collectUsedAndSortedCols(q)
 
-  let t0 = emitGetTime(prolog1)
+  streamGroup = getStreamGroup(q, settings)
+  spillGroup = streamGroup ? undefined : getSpillGroup(q, settings)
+  mergeJoins = getMergeJoins(q, settings)
+  radixJoin = streamGroup || spillGroup ? undefined : getRadixJoin(q, settings)
+
+  // in server mode the timing covers a single request
+  let t0 = emitGetTime(serverMode ? prolog1 : loadProlog)
 
   // Collect hashmaps needed for the query and relevant stateful ops
   // collectHashMaps()
@@ -1671,37 +2822,136 @@ let emitCode = (q, ir, settings) => {
   // Before we process the filters, we need to collect the arrays
   // We can also collect other stateful ops here
   collectOtherStatefulOps()
+  collectSketchMaps()
 
   // Process filters
   processFilters()
 
   let epilog = []
+  instrument.emitPhaseEnd(epilog, "loops")
+
+  // a sorted result that is printed up to a limit only needs its top entries
+  if (settings.limit > 0 && q.key == "pure" && q.op == "sort") topKSort = q
+  // the merge of an external sort of the result is read by the print loop
+  if (sortMemory && settings.format != "binary" && q.key == "pure" && q.op == "sort") streamedSort = q
+
+  if (radixJoin) {
+    // end of the pass, a build side over budget jumps here
+    epilog.push("radix_restart: ;")
+    epilog.push("}")
+    c.stmt(epilog)(c.call("radix_free", "&radix"))
+  }
+  emitSketchResults(epilog)
 
   let res = emitPath(epilog, q)
+  instrument.emitPhaseStart(epilog, "print")
 
-  if (res.cond) {
-    c.if(epilog)(res.cond, buf1 => {
-      c.printf(buf1)("undefined")
-      c.return(buf1)("0")
-    })
-  }
+  binaryLayout = undefined
+  if (settings.format == "binary") {
+    // undefined results are encoded in the validity of the value
+    if (res.schema.typeSym != typeSyms.never)
+      binaryLayout = binaryEmitter.emitValWrite(epilog, res, settings)
+  } else {
+    if (res.cond) {
+      c.if(epilog)(res.cond, buf1 => {
+        c.outLit(buf1)("undefined")
+        if (serverMode) {
+          c.stmt(buf1)(c.call("server_end_request"))
+          c.continue(buf1)()
+        } else {
+          c.stmt(buf1)(c.call("out_flush"))
+          c.return(buf1)("0")
+        }
+      })
+    }
 
-  if (res.schema.typeSym != typeSyms.never)
-    printEmitter.emitValPrint(epilog, res, settings)
+    if (spillGroup) {
+      // groups of the input, then of each spilled file. The groups of a
+      // source that spilled are flushed, the others are final.
+      let map = tmpVars[spillGroup.i]
+      epilog.push("for (;;) {")
+      c.if(epilog)("spill.flushed", buf1 => {
+        emitSpillFlush(buf1, map)
+      }, buf1 => {
+        printEmitter.emitHashMapPartPrintJSON(buf1, res, settings, "spill.printed")
+      })
+      c.if(epilog)(c.not(c.call("spill_next", "&spill")), buf1 => {
+        c.break(buf1)()
+      })
+      emitSpillClear(epilog, map)
+      emitSpillMerge(epilog, map)
+      epilog.push("}")
+      c.outLit(epilog)("}")
+    } else if (streamGroup) {
+      // group of the last run
+      printEmitter.emitHashMapPartPrintJSON(epilog, res, settings, "run_printed")
+      c.outLit(epilog)("}")
+    } else if (res.schema.typeSym != typeSyms.never)
+      printEmitter.emitValPrint(epilog, res, settings)
+  }
 
   let t1 = emitGetTime(prolog1)
   // Return and close the main function
-  c.stmt(epilog)(c.call("fflush", "stdout"))
+  c.stmt(epilog)(c.call("out_flush"))
+  instrument.emitPhaseEnd(epilog, "print")
   let t2 = emitGetTime(epilog)
 
   c.printErr(epilog)(`\\n\\nTiming:\\n\\tInitializaton:\\t%ld μs\\n\\tRuntime:\\t%ld μs\\n\\tTotal:\\t\\t%ld μs\\n`, c.sub(t1, t0), c.sub(t2, t1), c.sub(t2, t0))
 
+  if (perfCounters) {
+    // one line of JSON, picked up by func.explain.perf
+    c.printErr(epilog)(`Perf: {\\"available\\": %d`, "perf_available")
+    for (let [name, from, to] of [["Initialization", t0, t1], ["Runtime", t1, t2], ["Total", t0, t2]])
+      c.stmt(epilog)(c.call("perf_print_phase", `"${name}"`, "&" + perfSample(from), "&" + perfSample(to)))
+    c.printErr(epilog)(`}\\n`)
+  }
+
+  // hashmaps are named by their tmp
+  let exprOfTmp = (id) => {
+    let i = id.startsWith?.("tmp") ? id.substring(3) : undefined
+    if (assignments[i]) return pretty(assignments[i])
+  }
+
+  instrumentGenerators()
+  instrument.emitReport(epilog, files.instrument, (kind, id) => {
+    if (kind == "hashmap") return exprOfTmp(id)
+  })
+  memory.emitReport(epilog, files.memory, exprOfTmp)
+  if (settings.autoSize) hashmap.emitCountsReport(epilog, files.counts)
+  for (let i in distinctSets) c.stmt(epilog)(c.call("distinct_free", "&" + distinctSets[i]))
+  for (let i in sketchMaps) c.stmt(epilog)(c.call("sketch_free", "&" + sketchMaps[i].sym))
+
+  if (serverMode) {
+    // end of the request loop
+    c.stmt(epilog)(c.call("server_end_request"))
+    epilog.push("}")
+  }
+
   if (backend == "cuda") {
     c.stmt(epilog)(c.call("cublasDestroy", "handle"))
   }
   c.return(epilog)("0")
   epilog.push("}")
 
+  if (instrument.isEnabled()) {
+    instrument.emitPhaseEnd(loadProlog, "load")
+    let init = []
+    if (serverMode) instrument.emitRequestReset(init)
+    instrument.emitPhaseStart(init, "init")
+    prolog1.unshift(...init)
+    instrument.emitPhaseEnd(prolog1, "init")
+    instrument.emitPhaseStart(prolog1, "loops")
+    instrument.emitDecls(prolog0)
+  }
+  if (memory.isEnabled()) {
+    if (serverMode) {
+      let init = []
+      memory.emitRequestReset(init, loadProlog)
+      prolog1.unshift(...init)
+    }
+    memory.emitDecls(prolog0)
+  }
+
   // Construct the prolog
   let prolog = finalizeProlog()
 
@@ -1748,27 +2998,221 @@ let generateC = (q, ir, settings) => {
 
   let cFile = joinPaths(outDir, outFile + ext)
   let out = joinPaths(outDir, outFile)
-  let code = emitCode(q, ir, settings)
+  let reportFile = out + ".instrument.json"
+  let memoryFile = out + ".memory.json"
+  let countsFile = out + ".counts.json"
+
+  // Size the data structures from the counts observed by previous runs of
+  // the same query
+  let cacheDir = settings.cacheDir || "cgen-sql/cache"
+  let sizesFile = settings.autoSize ? cache.getSizesFile(cacheDir, pretty(q), ir.assignments.map(pretty)) : undefined
+  let observedCounts = settings.autoSize ? cache.readSizes(sizesFile) : undefined
+
+  let code = emitCode(q, ir, { ...settings, observedCounts }, { instrument: reportFile, memory: memoryFile, counts: countsFile })
 
   let compiler = settings.backend == "c" ? (settings.compiler || "gcc") : "nvcc"
   let cFlags = settings.cFlags || "-Icgen-sql -O3"
 
-  async function func() {
-    let stdout = await sh(`./${out} `)
-    return stdout
+  // Tiered compilation: a quickly compiled binary answers the first calls
+  // while the optimized one is built in the background
+  let tiered = settings.tiered && backend == "c"
+  let fastCompiler = settings.fastCompiler || compiler
+  let fastCFlags = settings.fastCFlags || cFlags.replace(/-O\S*|-march=\S*/g, "").trim() + " -O0"
+  if (tiered && !/-march=/.test(cFlags)) cFlags += " -march=native"
+
+  // binary used by func, switches to the optimized one once it is ready
+  let binary = out
+
+  // Binary results are read from a pipe without a size limit and decoded
+  // into JS values (or columns of typed arrays with columnar set)
+  let runBinary = (layout, columnar, args) => new Promise((resolve, reject) => {
+    let child = os.spawn(`./${binary}`, args, { stdio: ["ignore", "pipe", "ignore"] })
+    let chunks = []
+    child.stdout.on("data", chunk => chunks.push(chunk))
+    child.on("error", reject)
+    child.on("close", code => {
+      if (code != 0) return reject(new Error(`Command failed: ./${binary} (exit code ${code})`))
+      if (layout === undefined) return resolve(undefined)
+      try {
+        resolve(binaryDecoder.decodeBinary(Buffer.concat(chunks), layout, columnar))
+      } catch (e) {
+        reject(e)
+      }
+    })
+  })
+
+  let layout = binaryLayout
+  let paramNames = Object.keys(params)
+
+  // Parameter values are passed as arguments, so no recompilation is needed
+  let getArgs = (values) => paramNames.map(name => {
+    let v = values[name]
+    if (v === undefined) throw new Error("Missing value for query parameter " + name)
+    return String(v)
+  })
+
+  let run = (args) => new Promise((resolve, reject) => {
+    os.execFile(`./${binary}`, args, { maxBuffer: Infinity }, (err, stdout, stderr) => {
+      if (err) {
+        reject(err)
+      } else {
+        if (settings.perfCounters) readPerf(stderr)
+        resolve(stdout)
+      }
+    })
+  })
+
+  // hardware counters per phase, printed after the timing
+  let readPerf = (stderr) => {
+    let line = stderr.split("\n").find(l => l.startsWith("Perf: "))
+    if (line) func.explain.perf = JSON.parse(line.substring("Perf: ".length))
   }
 
-  func.explain = {}
+  // In server mode the binary is started on first use and kept running,
+  // func.close() stops it
+  let queryServer
+  let runServer = async (args, columnar) => {
+    if (queryServer?.binary != `./${binary}`) {
+      // restart on the optimized binary, pending requests still complete
+      queryServer?.close()
+      queryServer = new server.QueryServer(`./${binary}`)
+    }
+    let res = await queryServer.request(args)
+    if (settings.format == "binary")
+      return layout === undefined ? undefined : binaryDecoder.decodeBinary(res, layout, columnar)
+    return res.toString()
+  }
+
+  let runQuery = (args, options) => {
+    if (settings.server)
+      return runServer(args, options.columnar)
+    if (settings.format == "binary")
+      return runBinary(layout, options.columnar, args)
+    return run(args)
+  }
+
+  async function func(values = {}, options = {}) {
+    let res = await runQuery(getArgs(values), options)
+    // counters and phase times of the last run
+    if (settings.instrument) func.explain.instrument = JSON.parse(await fs.readFile(reportFile))
+    // bytes reserved and used per data structure, peak RSS of the last run
+    if (settings.memoryStats) func.explain.memory = JSON.parse(await fs.readFile(memoryFile))
+    if (settings.autoSize) await cache.recordSizes(sizesFile, JSON.parse(await fs.readFile(countsFile)))
+    return res
+  }
+
+  func.explain = { params: paramNames, keyEstimates }
+  if (spillGroup) func.explain.spill = { maxGroups: spillGroup.maxGroups }
+  if (streamGroup) func.explain.streamGroup = { group: tmpSym(streamGroup.i) }
+  if (Object.keys(mergeJoins).length > 0) func.explain.mergeJoins = Object.keys(mergeJoins).map(tmpSym)
+  if (radixJoin) func.explain.radixJoin = { build: tmpSym(radixJoin.i), partitions: 1 << radixJoin.bits, maxGroups: radixJoin.maxGroups }
+  if (settings.autoSize) func.explain.autoSize = { sizesFile, observedCounts }
+  if (settings.server) func.close = () => queryServer?.close()
+  if (settings.format == "binary") func.explain.layout = layout
 
   let writeAndCompile = async () => {
     await fs.writeFile(cFile, code)
-    if (inputFiles["json"] || inputFiles["ndjson"]) cFlags += " -Ithird-party/yyjson -Lthird-party/yyjson/out -lyyjson"
-    if (backend == "cuda") cFlags += " -lcublas"
+    let libFlags = ""
+    if (usesYYJSON()) libFlags += " -Ithird-party/yyjson -Lthird-party/yyjson/out -lyyjson"
+    if (backend == "cuda") libFlags += " -lcublas"
+    if (settings.sortThreads > 1) libFlags += " -pthread"
+    if (Object.keys(sketchMaps).length > 0) libFlags += " -lm"
+    cFlags += libFlags
     let cmd = `${compiler} ${cFile} -o ${out} ${cFlags}`
-    console.log("Executing: " + cmd)
     let time1 = performance.now()
-    await sh(cmd)
     func.explain.time = time1
+
+    // Skip compilation if the same code was compiled with the same settings before
+    let key
+    if (settings.cache) {
+      // profile-optimized binaries are cached separately from plain ones
+      key = await cache.getCacheKey(code, compiler, settings.pgo ? cFlags + " -fprofile-use" : cFlags)
+      let entry = await cache.lookup(cacheDir, key, out)
+      func.explain.cache = { key, hit: entry !== undefined, hits: cache.stats.hits, misses: cache.stats.misses }
+      if (entry) {
+        func.explain.cache.savedCompileTime = entry.compileTime
+        if (entry.pgo) func.explain.pgo = entry.pgo
+        if (tiered) {
+          func.explain.tier = 1
+          func.optimized = Promise.resolve()
+        }
+        return func
+      }
+    }
+
+    // Run the binary once on the training parameters, returns the wall time
+    let timeRun = (args) => new Promise((resolve, reject) => {
+      let start = performance.now()
+      let child = os.execFile(`./${out}`, args, { maxBuffer: Infinity }, err => {
+        if (err) reject(err)
+        else resolve(performance.now() - start)
+      })
+      // a server binary gets a single request, others may exit without reading
+      child.stdin.on("error", () => { })
+      if (settings.server) child.stdin.end(args.join("\t") + "\n")
+      else child.stdin.end()
+    })
+    let bestOf = async (runs, args) => {
+      let best = Infinity
+      for (let i = 0; i < runs; i++) best = Math.min(best, await timeRun(args))
+      return best
+    }
+
+    // Profile-guided optimization with gcc: instrument, train, rebuild.
+    // All builds use the same output name so that the profile is found again.
+    let optimizeWithProfile = async () => {
+      let { params: training = {}, runs = 3 } = settings.pgo === true ? {} : settings.pgo
+      let args = getArgs(training)
+      let profileDir = out + "_profile"
+      let baseTime = await bestOf(runs, args)
+
+      await sh(`rm -rf ${profileDir}`)
+      let genCmd = `${cmd} -fprofile-generate=${profileDir}`
+      console.log("Executing: " + genCmd)
+      await sh(genCmd)
+      let trainingTime = await timeRun(args)
+
+      let useCmd = `${cmd} -fprofile-use=${profileDir} -fprofile-correction -Wno-missing-profile`
+      console.log("Executing: " + useCmd)
+      await sh(useCmd)
+      let pgoTime = await bestOf(runs, args)
+
+      func.explain.pgo = { baseTime, trainingTime, pgoTime, speedup: baseTime / pgoTime }
+    }
+
+    let compileOptimized = async () => {
+      console.log("Executing: " + cmd)
+      await sh(cmd)
+      if (settings.pgo) await optimizeWithProfile()
+      func.explain.compileTime = performance.now() - time1
+
+      if (settings.cache) await cache.store(cacheDir, key, out, { compileTime: func.explain.compileTime, cmd, pgo: func.explain.pgo })
+    }
+
+    if (!tiered) {
+      await compileOptimized()
+      return func
+    }
+
+    let fastOut = out + "_tier0"
+    let fastCmd = `${fastCompiler} ${cFile} -o ${fastOut} ${fastCFlags}${libFlags}`
+    let fastBuild = sh(fastCmd)
+    // both builds start right away, the optimized one is not awaited
+    func.optimized = compileOptimized().then(() => {
+      binary = out
+      func.explain.tier = 1
+    }, e => {
+      // keep running the fast binary
+      func.explain.tierError = e.message
+    })
+
+    console.log("Executing: " + fastCmd)
+    await fastBuild
+    func.explain.fastCompileTime = performance.now() - time1
+    if (func.explain.tier === undefined) {
+      binary = fastOut
+      func.explain.tier = 0
+    }
     return func
   }
 
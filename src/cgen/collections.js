@@ -3,6 +3,8 @@ const { json } = require("./json")
 const { symbol } = require("./symbol")
 const { typing, types, typeSyms } = require('../typing')
 const { TAG, value } = require("./value")
+const { instrument } = require("./instrument")
+const { memory } = require("./memory")
 
 const { pretty } = require('../prettyprint')
 
@@ -22,6 +24,12 @@ let arraySize
 
 let checkOutOfBounds
 
+// Final key / element counts observed in previous runs (settings.autoSize),
+// by tmp. Structures with an observation are sized from it instead of from
+// hashSize / arraySize.
+let observedCounts
+let countedStructures
+
 let reset = (settings) => {
   hashSize = settings.hashSize || 256
   nestedHashSize = settings.nestedHashSize || 256
@@ -34,52 +42,91 @@ let reset = (settings) => {
   checkOutOfBounds = settings.checkOutOfBounds
 
   hashMask = hashSize - 1
+
+  observedCounts = settings.observedCounts || {}
+  countedStructures = []
 }
 
-let allocateStringBuffer = (buf, str, len, size, global, prolog0) => {
+// Twice the observed count as headroom. Hash tables are kept at most half
+// full on top of that and need a power of two for the mask.
+// Without an observation, the key count estimated from the statistics
+// catalog is used.
+let hashCapacity = (sym, estimate) => {
+  let n = observedCounts[sym] ?? estimate
+  if (n === undefined) return hashSize
+  let size = 16
+  while (size < 2 * (n + 1) * 2) size *= 2
+  return size
+}
+
+let arrayCapacity = (sym) => {
+  let n = observedCounts[sym]
+  if (n === undefined) return arraySize
+  return Math.max(16, 2 * n)
+}
+
+// Write the final count of each top-level hashmap and array as JSON, the
+// host merges them into the stats used by the next compilation
+let emitCountsReport = (buf, filename) => {
+  let f = symbol.getSymbol("counts_file")
+  c.declarePtr(buf)("FILE", f, c.call("fopen", JSON.stringify(filename), "\"w\""))
+  c.if(buf)(f, buf1 => {
+    let fmt = "{" + countedStructures.map(({ sym }) => `${JSON.stringify(sym)}: %d`).join(", ") + "}\n"
+    let args = countedStructures.map(({ count }) => ", " + count).join("")
+    buf1.push(`fprintf(${f}, ${JSON.stringify(fmt)}${args});`)
+    c.stmt(buf1)(c.call("fclose", f))
+  })
+}
+
+// count is the number of entries in use, for memory accounting
+let allocateStringBuffer = (buf, str, len, size, global, prolog0, count) => {
+  let strAlloc = c.cast("const char **", memory.track(buf, c.malloc("const char *", size), str, "const char *", size, count))
+  let lenAlloc = c.cast("int *", memory.track(buf, c.malloc("int", size), len, "int", size, count))
   if (global) {
     c.declareCharPtrPtr(prolog0)(str)
     c.declareIntPtr(prolog0)(len)
-    c.stmt(buf)(c.assign(str, c.cast("const char **", c.malloc("const char *", size))))
-    c.stmt(buf)(c.assign(len, c.cast("int *", c.malloc("int", size))))
+    c.stmt(buf)(c.assign(str, strAlloc))
+    c.stmt(buf)(c.assign(len, lenAlloc))
   } else {
-    c.declareCharPtrPtr(buf)(str, c.cast("const char **", c.malloc("const char *", size)))
-    c.declareIntPtr(buf)(len, c.cast("int *", c.malloc("int", size)))
+    c.declareCharPtrPtr(buf)(str, strAlloc)
+    c.declareIntPtr(buf)(len, lenAlloc)
   }
 }
 
-let allocatePrimitiveBuffer = (buf, type, name, size, global, prolog0) => {
+let allocatePrimitiveBuffer = (buf, type, name, size, global, prolog0, count) => {
+  let alloc = c.cast(`${type} *`, memory.track(buf, c.malloc(type, size), name, type, size, count))
   if (global) {
     c.declarePtr(prolog0)(type, name)
-    c.stmt(buf)(c.assign(name, c.cast(`${type} *`, c.malloc(type, size))))
+    c.stmt(buf)(c.assign(name, alloc))
   } else {
-    c.declarePtr(buf)(type, name, c.cast(`${type} *`, c.malloc(type, size)))
+    c.declarePtr(buf)(type, name, alloc)
   }
 }
 
-let allocateYYJSONBuffer = (buf, name, size, global, prolog0) => {
+let allocateYYJSONBuffer = (buf, name, size, global, prolog0, count) => {
   let size$ = size || arraySize
+  let alloc = c.cast("yyjson_val **", memory.track(buf, c.malloc("yyjson_val *", size$), name, "yyjson_val *", size$, count))
   if (global) {
     c.declarePtr(prolog0)("yyjson_val", name)
-    c.stmt(buf)(c.assign(name, c.cast("yyjson_val **", c.malloc("yyjson_val *", size$))))
+    c.stmt(buf)(c.assign(name, alloc))
   } else {
-    c.declarePtrPtr(buf)("yyjson_val", name, c.cast("yyjson_val **", c.malloc("yyjson_val *", size$)))
+    c.declarePtrPtr(buf)("yyjson_val", name, alloc)
   }
 }
 
-let emitHashMapKeyDecls = (buf, sym, keySchema, size = hashSize) => {
+let emitHashMapKeyDecls = (buf, sym, keySchema, count, size = hashSize) => {
   let keys = []
   for (let i in keySchema) {
     let schema = keySchema[i]
     if (typing.isUnknown(schema)) {
-      allocateYYJSONBuffer(buf, `${sym}_keys${i}`, size)
+      allocateYYJSONBuffer(buf, `${sym}_keys${i}`, size, false, undefined, count)
       keys.push(value.json(schema, `${sym}_keys${i}`))
     } else if (typing.isString(schema)) {
-      allocateStringBuffer(buf, `${sym}_keys_str${i}`, `${sym}_keys_len${i}`, size)
+      allocateStringBuffer(buf, `${sym}_keys_str${i}`, `${sym}_keys_len${i}`, size, false, undefined, count)
       keys.push(value.string(schema, `${sym}_keys_str${i}`, `${sym}_keys_len${i}`))
     } else {
       let cType = utils.convertToCType(schema)
-      allocatePrimitiveBuffer(buf, cType, `${sym}_keys${i}`, size)
+      allocatePrimitiveBuffer(buf, cType, `${sym}_keys${i}`, size, false, undefined, count)
       keys.push(value.primitive(schema, `${sym}_keys${i}`))
     }
   }
@@ -97,8 +144,9 @@ let emitHashMapLinkedBucketsInit = (buf, map, name, schema, defined) => {
   let prev = `${sym}_${name}_prev`
 
   c.declareInt(buf)(count, "0")
-  c.declareIntPtr(buf)(head, c.cast("int *", c.malloc("int", hashSize)))
-  c.declareIntPtr(buf)(prev, c.cast("int *", c.calloc("int", linkedBucketsSize)))
+  let size = map.val.capacity ?? hashSize
+  c.declareIntPtr(buf)(head, c.cast("int *", memory.track(buf, c.malloc("int", size), head, "int", size, map.val.count)))
+  c.declareIntPtr(buf)(prev, c.cast("int *", memory.track(buf, c.calloc("int", linkedBucketsSize), prev, "int", linkedBucketsSize, count)))
 
   res.val = { count, head, prev }
   res.tag = TAG.HASHMAP_LINKED_BUCKET
@@ -107,7 +155,7 @@ let emitHashMapLinkedBucketsInit = (buf, map, name, schema, defined) => {
     if (map.tag == TAG.NESTED_HASHMAP) {
       map.val.struct.addField("uint8_t *", `${sym}_${name}_defined`)
     } else
-      c.declarePtr(buf)("uint8_t", `${sym}_${name}_defined`, c.cast(`uint8_t *`, c.calloc("uint8_t", hashSize)))
+      c.declarePtr(buf)("uint8_t", `${sym}_${name}_defined`, c.cast(`uint8_t *`, memory.track(buf, c.calloc("uint8_t", size), `${sym}_${name}_defined`, "uint8_t", size, map.val.count)))
     res.defined = `${sym}_${name}_defined`
   }
 
@@ -121,19 +169,19 @@ let emitHashMapLinkedBucketValuesInit = (buf, map, bucket, name, schema) => {
   let res = { schema }
 
   if (typing.isUnknown(schema)) {
-    allocateYYJSONBuffer(buf, `${sym}_${name}`, linkedBucketsSize)
+    allocateYYJSONBuffer(buf, `${sym}_${name}`, linkedBucketsSize, false, undefined, bucket.val.count)
     res.val = `${sym}_${name}`
     res.tag = TAG.JSON
   } else if (typing.isObject(schema)) {
     // Nested hashmap
     throw new Error("Nested hashmap not supported for now")
   } else if (typing.isString(schema)) {
-    allocateStringBuffer(buf, `${sym}_${name}_str`, `${sym}_${name}_len`, linkedBucketsSize)
+    allocateStringBuffer(buf, `${sym}_${name}_str`, `${sym}_${name}_len`, linkedBucketsSize, false, undefined, bucket.val.count)
     res.val = { str: `${sym}_${name}_str`, len: `${sym}_${name}_len` }
   } else {
     // let convertToCType report "type not supported" errors
     let cType = utils.convertToCType(schema)
-    allocatePrimitiveBuffer(buf, cType, `${sym}_${name}`, linkedBucketsSize)
+    allocatePrimitiveBuffer(buf, cType, `${sym}_${name}`, linkedBucketsSize, false, undefined, bucket.val.count)
     res.val = `${sym}_${name}`
   }
 
@@ -148,7 +196,8 @@ let emitHashMapBucketsInit = (buf, map, name, schema, defined) => {
 
   let count = `${sym}_${name}_bucket_counts`
 
-  c.declareIntPtr(buf)(count, c.cast("int *", c.malloc("int", hashSize)))
+  let size = map.val.capacity ?? hashSize
+  c.declareIntPtr(buf)(count, c.cast("int *", memory.track(buf, c.malloc("int", size), count, "int", size, map.val.count)))
 
   res.val = { count }
   res.tag = TAG.HASHMAP_BUCKET
@@ -157,7 +206,7 @@ let emitHashMapBucketsInit = (buf, map, name, schema, defined) => {
     if (map.tag == TAG.NESTED_HASHMAP) {
       map.val.struct.addField("uint8_t *", `${sym}_${name}_defined`)
     } else
-      c.declarePtr(buf)("uint8_t", `${sym}_${name}_defined`, c.cast(`uint8_t *`, c.calloc("uint8_t", hashSize)))
+      c.declarePtr(buf)("uint8_t", `${sym}_${name}_defined`, c.cast(`uint8_t *`, memory.track(buf, c.calloc("uint8_t", size), `${sym}_${name}_defined`, "uint8_t", size, map.val.count)))
     res.defined = `${sym}_${name}_defined`
   }
 
@@ -195,7 +244,7 @@ let emitHashMapValueInit = (buf, map, name, schema, defined, sorted, prolog0) =>
   if (name == "_DEFAULT_" && map.val.values?.[name]) return
 
   let sym = tmpSym(map.val.sym)
-  let size = hashSize
+  let size = map.val.capacity ?? hashSize
 
   c.comment(buf)(`value of ${sym}: ${name}`)
   let res = { schema }
@@ -206,14 +255,14 @@ let emitHashMapValueInit = (buf, map, name, schema, defined, sorted, prolog0) =>
       map.val.struct.addField("const char **", `${sym}_${name}_str`)
       map.val.struct.addField("int *", `${sym}_${name}_len`)
     } else
-      allocateStringBuffer(buf, `${sym}_${name}_str`, `${sym}_${name}_len`, size, sorted, prolog0)
+      allocateStringBuffer(buf, `${sym}_${name}_str`, `${sym}_${name}_len`, size, sorted, prolog0, map.val.count)
     res.val = { str: `${sym}_${name}_str`, len: `${sym}_${name}_len` }
   } else {
     let cType = utils.convertToCType(schema)
     if (map.tag == TAG.NESTED_HASHMAP) {
       map.val.struct.addField(cType + " *", `${sym}_${name}`)
     } else
-      allocatePrimitiveBuffer(buf, cType, `${sym}_${name}`, size, sorted, prolog0)
+      allocatePrimitiveBuffer(buf, cType, `${sym}_${name}`, size, sorted, prolog0, map.val.count)
     res.val = `${sym}_${name}`
   }
 
@@ -221,7 +270,7 @@ let emitHashMapValueInit = (buf, map, name, schema, defined, sorted, prolog0) =>
     if (map.tag == TAG.NESTED_HASHMAP) {
       map.val.struct.addField("uint8_t *", `${sym}_${name}_defined`)
     } else
-      c.declarePtr(buf)("uint8_t", `${sym}_${name}_defined`, c.cast(`uint8_t *`, c.calloc("uint8_t", size)))
+      c.declarePtr(buf)("uint8_t", `${sym}_${name}_defined`, c.cast(`uint8_t *`, memory.track(buf, c.calloc("uint8_t", size), `${sym}_${name}_defined`, "uint8_t", size, map.val.count)))
     res.defined = `${sym}_${name}_defined`
   }
 
@@ -260,7 +309,8 @@ let emitNestedHashMapInit = (buf, i, map, name, schema, keySchema) => {
   if (map.tag == TAG.NESTED_HASHMAP) {
     map.val.struct.addField("struct " + sym + " **", ptr)
   } else {
-    c.declarePtrPtr(buf)("struct " + sym, ptr, c.cast("struct " + sym + " **", c.malloc("struct " + sym + " *", hashSize)))
+    let size = map.val.capacity ?? hashSize
+    c.declarePtrPtr(buf)("struct " + sym, ptr, c.cast("struct " + sym + " **", memory.track(buf, c.malloc("struct " + sym + " *", size), ptr, "struct " + sym + " *", size, map.val.count)))
   }
 
   let count = `${sym}_key_count`
@@ -285,67 +335,72 @@ let emitNestedHashMapInit = (buf, i, map, name, schema, keySchema) => {
 
 let emitNestedHashMapAllocation = (buf, map) => {
   let assign = (...args) => c.stmt(buf)(c.assign(...args))
+  // allocated per key, the entries in use are not known at exit
+  let sym = map.val.struct.name
+  let track = (alloc, name, type, size) => memory.track(buf, alloc, `${sym}_${name}`, type, size)
 
-  assign(map.val.ptr, c.cast(`struct ${map.val.struct.name} *`, c.malloc(`struct ${map.val.struct.name}`, 1)))
+  assign(map.val.ptr, c.cast(`struct ${map.val.struct.name} *`, track(c.malloc(`struct ${sym}`, 1), "struct", `struct ${sym}`, 1)))
   assign(map.val.count, "0")
-  assign(map.val.htable, c.cast("int *", c.calloc("int", nestedHashSize)))
+  assign(map.val.htable, c.cast("int *", track(c.calloc("int", nestedHashSize), "htable", "int", nestedHashSize)))
   // c.stmt(buf)(c.call("memset", map.val.htable, "-1", `sizeof(int) * ${hashSize}`))
 
   for (let i in map.val.keys) {
     let key = map.val.keys[i]
     if (typing.isString(key.schema)) {
-      assign(key.val.str, c.cast("const char **", c.malloc("const char *", nestedHashSize)))
-      assign(key.val.len, c.cast("int *", c.malloc("int", nestedHashSize)))
+      assign(key.val.str, c.cast("const char **", track(c.malloc("const char *", nestedHashSize), `keys_str${i}`, "const char *", nestedHashSize)))
+      assign(key.val.len, c.cast("int *", track(c.malloc("int", nestedHashSize), `keys_len${i}`, "int", nestedHashSize)))
     } else {
       let cType = utils.convertToCType(key.schema)
-      assign(key.val, c.cast(`${cType} *`, c.malloc(cType, nestedHashSize)))
+      assign(key.val, c.cast(`${cType} *`, track(c.malloc(cType, nestedHashSize), `keys${i}`, cType, nestedHashSize)))
     }
   }
 
   for (let name in map.val.values) {
     let value = map.val.values[name]
     if (value.tag == TAG.NESTED_HASHMAP) {
-      assign(value.val.ptr, c.cast(`struct ${value.val.struct.name} **`, c.malloc(`struct ${value.val.struct.name} *`, nestedHashSize)))
+      assign(value.val.ptr, c.cast(`struct ${value.val.struct.name} **`, track(c.malloc(`struct ${value.val.struct.name} *`, nestedHashSize), name, `struct ${value.val.struct.name} *`, nestedHashSize)))
       // throw new Error("Not implemented yet")
     } else if (value.tag == TAG.HASHMAP_BUCKET) {
       throw new Error("Not implemented yet")
     } else if (typing.isString(value.schema)) {
-      assign(value.val.str, c.cast("const char **", c.malloc("const char *", nestedHashSize)))
-      assign(value.val.len, c.cast("int *", c.malloc("int", nestedHashSize)))
+      assign(value.val.str, c.cast("const char **", track(c.malloc("const char *", nestedHashSize), `${name}_str`, "const char *", nestedHashSize)))
+      assign(value.val.len, c.cast("int *", track(c.malloc("int", nestedHashSize), `${name}_len`, "int", nestedHashSize)))
     } else {
       let cType = utils.convertToCType(value.schema)
-      assign(value.val, c.cast(`${cType} *`, c.malloc(cType, nestedHashSize)))
+      assign(value.val, c.cast(`${cType} *`, track(c.malloc(cType, nestedHashSize), name, cType, nestedHashSize)))
     }
     if (value.defined) {
-      assign(value.defined, c.cast("uint8_t *", c.calloc("uint8_t", nestedHashSize)))
+      assign(value.defined, c.cast("uint8_t *", track(c.calloc("uint8_t", nestedHashSize), `${name}_defined`, "uint8_t", nestedHashSize)))
     }
   }
 }
 
 // Initialize the key arrays
 // The value arrays will be added and associated to this hashmap later
-let emitHashMapInit = (buf, i, keySchema) => {
+let emitHashMapInit = (buf, i, keySchema, estimate) => {
   let sym = tmpSym(i)
   c.comment(buf)(`init hashmap for ${sym}`)
   // keys
   c.comment(buf)(`keys of ${sym}`)
 
-  let keys = emitHashMapKeyDecls(buf, sym, keySchema)
   let count = `${sym}_key_count`
   let htable = `${sym}_htable`
+  let capacity = hashCapacity(sym, estimate)
+  let keys = emitHashMapKeyDecls(buf, sym, keySchema, count, capacity)
+  countedStructures.push({ sym, count })
 
   c.comment(buf)(`key count for ${sym}`)
   c.declareInt(buf)(count, "0")
 
   // htable
   c.comment(buf)(`hash table for ${sym}`)
-  c.declareIntPtr(buf)(htable, c.cast("int *", c.calloc("int", hashSize)))
+  c.declareIntPtr(buf)(htable, c.cast("int *", memory.track(buf, c.calloc("int", capacity), htable, "int", capacity, count)))
 
   // init htable entries to -1
   // c.comment(buf)(`init hash table entries to -1 for ${sym}`)
   // c.stmt(buf)(c.call("memset", htable, "-1", `sizeof(int) * ${hashSize}`))
 
-  return { htable, count, keys }
+  return { htable, count, keys, capacity }
 }
 
 // Calculate the hash value for a set of keys
@@ -382,6 +437,33 @@ let hash = (buf, key) => {
 }
 
 let emitHashMapInsert = (buf, map, key, pos, keyPos, lhs, init) => {
+  if (map.val.flushRun) {
+    // the run of the previous key has ended, it is the only entry
+    c.if(buf)(c.ne(map.val.count, "0"), buf1 => {
+      map.val.flushRun(buf1)
+      c.stmt(buf1)(c.assign(map.val.count, "0"))
+    })
+  }
+  if (map.val.spillFlush) {
+    // over budget: the groups are spilled to their partitions
+    c.if(buf)(c.eq(map.val.count, map.val.spillLimit), buf1 => {
+      map.val.spillFlush(buf1)
+    })
+  } else if (map.val.spillLimit) {
+    // over budget: split the partition and start the pass again
+    c.if(buf)(c.eq(map.val.count, map.val.spillLimit), buf1 => {
+      c.stmt(buf1)(c.call("radix_split", "&radix"))
+      c.stmt(buf1)("goto radix_restart")
+    })
+  }
+  if (map.val.mergeCursor) {
+    // a new key has to come after all others
+    c.if(buf)(c.le(map.val.mergeCursor, map.val.count), buf1 => {
+      c.printErr(buf1)("join input declared sorted is not in ascending order\\n")
+      c.return(buf1)("1")
+    })
+  }
+  instrument.emitInc(buf, instrument.counter("hashmap", tmpSym(map.val.sym), "inserts"))
   c.stmt(buf)(c.inc(map.val.count))
   c.stmt(buf)(c.assign(keyPos, map.val.count))
 
@@ -402,8 +484,7 @@ let emitHashMapInsert = (buf, map, key, pos, keyPos, lhs, init) => {
       let keyStr = map.val.keys[i].val.str + indexing
       let keyLen = map.val.keys[i].val.len + indexing
 
-      c.stmt(buf)(c.assign(keyStr, key.val.str))
-      c.stmt(buf)(c.assign(keyLen, key.val.len))
+      utils.emitStoreString(buf, { str: keyStr, len: keyLen }, key)
     } else {
       c.stmt(buf)(c.assign(map.val.keys[i].val + indexing, key.val))
     }
@@ -422,47 +503,118 @@ let emitHashLookUp = (buf, map, key) => {
   let pos = symbol.getSymbol("tmp_pos") + "$" // aid cse
   let keyPos1 = symbol.getSymbol("key_pos") + "$"
 
+  let lookups = instrument.counter("hashmap", tmpSym(sym), "lookups")
+  let probes = instrument.counter("hashmap", tmpSym(sym), "probes")
+
   let stmt = {
     map,
     key,
     out: [pos, keyPos1],
     emit: function (buf) {
-      let hashed = hash(buf, key)
-
       let [pos, keyPos1] = this.out
-      c.declareULong(buf)(pos, c.binary(hashed, mask, "&"))
-
-      let keyPos = `${map.val.htable}[${pos}]`
-      let indexing = "[" + keyPos + "]"
 
-      let compareKeys = undefined
-
-      let keys = key.tag == TAG.COMBINED_KEY ? key.val.keys : [key]
-      for (let i in keys) {
-        let key = keys[i]
-        let schema = key.schema
-        if (key.tag == TAG.JSON) {
-          key = json.convertJSONTo(key, schema)
+      // condition that the key differs from the one at keyPos. compare_str2
+      // only compares the common prefix, without a matching hash the
+      // lengths are compared as well (exact)
+      let compareKeysAt = (keyPos, exact) => {
+        let indexing = "[" + keyPos + "]"
+        let compareKeys = undefined
+
+        let keys = key.tag == TAG.COMBINED_KEY ? key.val.keys : [key]
+        for (let i in keys) {
+          let key = keys[i]
+          let schema = key.schema
+          if (key.tag == TAG.JSON) {
+            key = json.convertJSONTo(key, schema)
+          }
+
+          if (typing.isString(schema)) {
+            let keyStr = map.val.keys[i].val.str + indexing
+            let keyLen = map.val.keys[i].val.len + indexing
+
+            let { str, len } = key.val
+
+            let comparison = c.ne(c.call("compare_str2", keyStr, keyLen, str, len), "0")
+            if (exact) comparison = c.or(c.ne(keyLen, len), comparison)
+            compareKeys = compareKeys ? c.or(compareKeys, comparison) : comparison
+          } else {
+            let comparison = c.ne(map.val.keys[i].val + indexing, key.val)
+            compareKeys = compareKeys ? c.or(compareKeys, comparison) : comparison
+          }
         }
+        return compareKeys
+      }
 
-        if (typing.isString(schema)) {
-          let keyStr = map.val.keys[i].val.str + indexing
-          let keyLen = map.val.keys[i].val.len + indexing
+      if (map.val.flushRun) {
+        // keys arrive in runs: only the current key can match, no hashing
+        let count = map.val.count
+        c.declareULong(buf)(pos, "0")
+        instrument.emitInc(buf, lookups)
+        c.declareInt(buf)(keyPos1, c.ternary(c.and(c.ne(count, "0"), c.not(compareKeysAt(count, true))), count, "0"))
+        return
+      }
 
-          let { str, len } = key.val
+      if (map.val.mergeCursor) {
+        // keys in ascending order (merge join): the cursor moves forward
+        // over them, a smaller key moves it back by binary search
+        let cur = map.val.mergeCursor
+        let k = key.tag == TAG.JSON ? json.convertJSONTo(key, key.schema) : key
+        let keyAt = map.val.keys[0]
+        let before = idx => typing.isString(key.schema)
+          ? c.lt(c.call("compare_str3", `${keyAt.val.str}[${idx}]`, `${keyAt.val.len}[${idx}]`, k.val.str, k.val.len), "0")
+          : c.lt(`${keyAt.val}[${idx}]`, k.val)
+        c.if(buf)(c.and(c.gt(cur, "1"), c.not(before(c.sub(cur, "1")))), buf1 => {
+          let lo = symbol.getSymbol("lo")
+          let hi = symbol.getSymbol("hi")
+          let mid = symbol.getSymbol("mid")
+          c.declareInt(buf1)(lo, "1")
+          c.declareInt(buf1)(hi, c.sub(cur, "1"))
+          c.while(buf1)(c.lt(lo, hi), buf2 => {
+            c.declareInt(buf2)(mid, `(${lo} + ${hi}) / 2`)
+            c.if(buf2)(before(mid), buf3 => {
+              c.stmt(buf3)(c.assign(lo, c.add(mid, "1")))
+            }, buf3 => {
+              c.stmt(buf3)(c.assign(hi, mid))
+            })
+          })
+          c.stmt(buf1)(c.assign(cur, lo))
+        })
+        c.while(buf)(c.and(c.le(cur, map.val.count), before(cur)), buf1 => {
+          c.stmt(buf1)(c.inc(cur))
+        })
+        c.declareULong(buf)(pos, "0")
+        instrument.emitInc(buf, lookups)
+        c.declareInt(buf)(keyPos1, c.ternary(c.and(c.le(cur, map.val.count), c.not(compareKeysAt(cur, true))), cur, "0"))
+        return
+      }
 
-          let comparison = c.ne(c.call("compare_str2", keyStr, keyLen, str, len), "0")
-          compareKeys = compareKeys ? c.or(compareKeys, comparison) : comparison
-        } else {
-          let comparison = c.ne(map.val.keys[i].val + indexing, key.val)
-          compareKeys = compareKeys ? c.or(compareKeys, comparison) : comparison
-        }
+      if (map.val.denseMin !== undefined) {
+        // dense integer keys (see the catalog): the slot is the offset from
+        // the smallest key, it holds this key or none. A key probed from
+        // another input may be out of range and is compared.
+        let k = key.tag == TAG.JSON ? json.convertJSONTo(key, key.schema) : key
+        c.declareULong(buf)(pos, c.binary(c.cast("unsigned long", `(${k.val} - (${map.val.denseMin}))`), mask, "&"))
+        instrument.emitInc(buf, lookups)
+        let keyPos = `${map.val.htable}[${pos}]`
+        c.declareInt(buf)(keyPos1, c.ternary(c.and(c.ne(keyPos, "0"), c.not(compareKeysAt(keyPos, false))), keyPos, "0"))
+        return
       }
 
+      let hashed = hash(buf, key)
+
+      c.declareULong(buf)(pos, c.binary(hashed, mask, "&"))
+      instrument.emitInc(buf, lookups)
+
+      let keyPos = `${map.val.htable}[${pos}]`
+      // the small table of a partitioned group-by probes across many keys,
+      // one may be a prefix of another
+      let compareKeys = compareKeysAt(keyPos, map.val.spillLimit !== undefined)
+
       // increment the position until we find a match or an empty slot
       c.while(buf)(
         c.and(c.ne(keyPos, "0"), compareKeys),
         buf1 => {
+          instrument.emitInc(buf1, probes)
           c.stmt(buf1)(c.assign(pos, c.binary(c.add(pos, "1"), mask, "&")))
         }
       )
@@ -515,7 +667,7 @@ let emitHashLookUpAndUpdate = (buf, map, key, update, checkExistance) =>
 let emitHashLookUpAndUpdateCust = (buf, map, key, update1, update2, checkExistance) => {
   if (checkOutOfBounds && checkExistance) {
     // We might insert a new key into the map, check size
-    c.if(buf)(c.eq(map.val.count, hashSize), buf1 => {
+    c.if(buf)(c.eq(map.val.count, map.val.capacity ?? hashSize), buf1 => {
       c.printErr(buf1)("hashmap size reached its full capacity\\n")
       c.return(buf1)("1")
     })
@@ -661,6 +813,7 @@ let getHashMapValueEntry = (map, pos, keyPos) => {
 
 let emitArrayValueInit = (buf, arr, name, schema, sorted, prolog0) => {
   let sym = arr.val.sym
+  arr.val.capacity ??= arrayCapacity(sym)
 
   c.comment(buf)(`value of ${sym}: ${name}`)
   let res = { schema }
@@ -668,12 +821,12 @@ let emitArrayValueInit = (buf, arr, name, schema, sorted, prolog0) => {
     // Nested hashmap
     throw new Error("Not supported")
   } else if (typing.isString(schema)) {
-    allocateStringBuffer(buf, `${sym}_${name}_str`, `${sym}_${name}_len`, arraySize, sorted, prolog0)
+    allocateStringBuffer(buf, `${sym}_${name}_str`, `${sym}_${name}_len`, arr.val.capacity, sorted, prolog0, arr.val.count)
     res.val = { str: `${sym}_${name}_str`, len: `${sym}_${name}_len` }
   } else {
     // let convertToCType report "type not supported" errors
     let cType = utils.convertToCType(schema)
-    allocatePrimitiveBuffer(buf, cType, `${sym}_${name}`, arraySize, sorted, prolog0)
+    allocatePrimitiveBuffer(buf, cType, `${sym}_${name}`, arr.val.capacity, sorted, prolog0, arr.val.count)
     res.val = `${sym}_${name}`
   }
 
@@ -686,6 +839,7 @@ let emitArrayInit = (buf, sym) => {
   let count = `${sym}_data_count`
 
   c.declareInt(buf)(count)
+  countedStructures.push({ sym, count })
 
   return count
 }
@@ -712,15 +866,13 @@ let emitHashMapLinkedBucketInsert = (buf, bucket, value) => {
       }
 
       if (typing.isString(val.schema)) {
-        c.stmt(buf)(c.assign(lhs.val[key].val.str, val.val.str))
-        c.stmt(buf)(c.assign(lhs.val[key].val.len, val.val.len))
+        utils.emitStoreString(buf, lhs.val[key].val, val)
       } else {
         c.stmt(buf)(c.assign(lhs.val[key].val, val.val))
       }
     }
   } else if (typing.isString(value.schema)) {
-    c.stmt(buf)(c.assign(lhs.val.str, value.val.str))
-    c.stmt(buf)(c.assign(lhs.val.len, value.val.len))
+    utils.emitStoreString(buf, lhs.val, value)
   } else {
     c.stmt(buf)(c.assign(lhs.val, value.val))
   }
@@ -758,15 +910,13 @@ let emitArrayInsert = (buf, arr, value) => {
       }
 
       if (typing.isString(val.schema)) {
-        c.stmt(buf)(c.assign(lhs.val[key].val.str, val.val.str))
-        c.stmt(buf)(c.assign(lhs.val[key].val.len, val.val.len))
+        utils.emitStoreString(buf, lhs.val[key].val, val)
       } else {
         c.stmt(buf)(c.assign(lhs.val[key].val, val.val))
       }
     }
   } else if (typing.isString(value.schema)) {
-    c.stmt(buf)(c.assign(lhs.val.str, value.val.str))
-    c.stmt(buf)(c.assign(lhs.val.len, value.val.len))
+    utils.emitStoreString(buf, lhs.val, value)
   } else {
     c.stmt(buf)(c.assign(lhs.val, value.val))
   }
@@ -844,6 +994,8 @@ let array = {
 
 let hashmap = {
   reset,
+  hash,
+  emitCountsReport,
   emitHashMapInit,
   emitHashMapValueInit,
   emitHashMapBucketsInit,
@@ -0,0 +1,116 @@
+const fs = require("fs")
+const path = require("path")
+const { c, utils } = require("./utils")
+const { symbol } = require("./symbol")
+const { value, TAG } = require('./value')
+const { shred } = require("./shred")
+const { typing } = require('../typing')
+
+const { pretty } = require('../prettyprint')
+const { quoteVar } = utils
+
+// Check that the shredded directory matches the source file and the schema
+let readColumnMeta = (filename, dir, columns) => {
+  let metaFile = path.join(dir, "meta.json")
+  if (!fs.existsSync(metaFile))
+    throw new Error(`No shredded columns for ${filename} in ${dir}, run shredNDJSON first`)
+  let meta = JSON.parse(fs.readFileSync(metaFile))
+  if (fs.existsSync(filename)) {
+    let stat = fs.statSync(filename)
+    if (stat.size != meta.size || stat.mtimeMs != meta.mtimeMs)
+      throw new Error(`Shredded columns in ${dir} are out of date with ${filename}`)
+  }
+  let shredded = new Set(meta.columns.map(col => shred.columnName(col.path)))
+  for (let { path: p } of columns) {
+    if (!shredded.has(shred.columnName(p)))
+      throw new Error(`Column ${shred.columnName(p)} not found in ${dir}`)
+  }
+  return meta
+}
+
+// Map the column files of a shredded NDJSON file.
+// Returns a nested object of column symbols mirroring the record schema.
+let emitLoadColumns = (buf, filename, dir, schema) => {
+  let columnPaths = shred.getColumnPaths(schema.objValue)
+  readColumnMeta(filename, dir, columnPaths)
+
+  let dirStr = "\"" + dir + "\""
+  let sym = symbol.getSymbol("cols")
+  let rows = sym + "_rows"
+  c.declareVar(buf)("uint64_t", rows, `*(const uint64_t *)${c.call("map_column", dirStr, "\"rows.bin\"", "NULL")}`)
+
+  let columns = {}
+  columnPaths.forEach(({ path: p, schema: s }, i) => {
+    let name = shred.columnName(p)
+    let col = sym + "_" + i
+    let fields = columns
+    for (let k of p.slice(0, -1)) {
+      fields[k] ??= { fields: {} }
+      fields = fields[k].fields
+    }
+    buf.push(`// column ${name}`)
+    let res = { def: col + "_def" }
+    c.declarePtr(buf)("uint8_t", res.def, c.cast("const uint8_t *", c.call("map_column", dirStr, `"${name}.def"`, "NULL")), true)
+    if (typing.isString(s)) {
+      res.off = col + "_off"
+      res.str = col + "_str"
+      c.declarePtr(buf)("uint64_t", res.off, c.cast("const uint64_t *", c.call("map_column", dirStr, `"${name}.off"`, "NULL")), true)
+      c.declareConstCharPtr(buf)(res.str, c.call("map_column", dirStr, `"${name}.str"`, "NULL"))
+    } else {
+      res.val = col + "_val"
+      let cType = utils.convertToCType(s)
+      c.declarePtr(buf)(cType, res.val, c.cast(`const ${cType} *`, c.call("map_column", dirStr, `"${name}.val"`, "NULL")), true)
+    }
+    fields[p[p.length - 1]] = res
+  })
+
+  return { rows, columns }
+}
+
+// Record at row idx as an object of column values
+let getRecordAtIdx = (schema, columns, idx) => {
+  let val = {}
+  for (let { name, schema: s } of utils.convertToArrayOfSchema(schema)) {
+    let col = columns[name]
+    if (col === undefined) continue
+    if (col.fields) {
+      val[name] = getRecordAtIdx(s, col.fields, idx)
+      continue
+    }
+    let cond = c.not(c.call("def_bit", col.def, idx))
+    if (col.str) {
+      let start = `${col.off}[${idx}]`
+      let end = `${col.off}[${idx} + 1]`
+      val[name] = value.string(s, c.add(col.str, start), c.cast("int", c.sub(end, start)), undefined, cond)
+    } else {
+      val[name] = value.primitive(s, `${col.val}[${idx}]`, undefined, cond)
+    }
+  }
+  return { schema, val, tag: TAG.OBJECT }
+}
+
+let getColumnarLoopTxt = (f, cols, data) => () => {
+  let v = f.arg[1].op
+  let info = [`// generator: ${v} <- ${pretty(f.arg[0])}`]
+
+  let { rows } = cols.val
+
+  v = quoteVar(v)
+
+  let loopHeader = [`for (size_t ${v} = 0; ${v} < ${rows}; ${v}++) {`]
+  let boundsChecking = [`if (${v} >= ${rows}) break;`]
+
+  return {
+    info, data, initCursor: [], loopHeader, boundsChecking, rowScanning: []
+  }
+}
+
+let columnar = {
+  emitLoadColumns,
+  getRecordAtIdx,
+  getColumnarLoopTxt
+}
+
+module.exports = {
+  columnar
+}
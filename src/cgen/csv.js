@@ -242,7 +242,7 @@ let getCSVLoopTxt = (f, file, loadInput, usedCols) => () => {
   let rowScanning = emitRowScanning(f, file, cursor, schema, usedCols)
 
   return {
-    info, data: loadInput, initCursor, loopHeader, boundsChecking, rowScanning
+    info, data: loadInput, initCursor, loopHeader, boundsChecking, rowScanning, cursor
   }
 }
 
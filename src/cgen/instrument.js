@@ -0,0 +1,115 @@
+const { c } = require("./utils")
+
+// Runtime counters and phase timers for settings.instrument.
+//
+// Counters are grouped by what they measure: a generator loop, a filter, a
+// hashmap or a stateful op. Each group carries the pretty-printed Rhyme
+// expression it belongs to, so the JSON report written by the binary maps
+// back to the query:
+//
+//   { "phases": { "load": 12, ... },  // μs
+//     "groups": [{ "kind": "hashmap", "id": "tmp1", "expr": "...",
+//                  "counters": { "lookups": 3, "probes": 0, "inserts": 2 } }] }
+
+let enabled
+let groups
+let numCounters
+let phases
+
+let reset = (settings) => {
+  enabled = settings.instrument || false
+  groups = {}
+  numCounters = 0
+  phases = ["load", "init", "loops", "sort", "print"]
+}
+
+// Counters have to be requested while the code is generated, before the
+// declarations are emitted. Returns undefined without instrument.
+let counter = (kind, id, name, expr) => {
+  if (!enabled) return
+  let key = kind + ":" + id
+  groups[key] ??= { kind, id, expr, counters: {} }
+  groups[key].expr ??= expr
+  groups[key].counters[name] ??= numCounters++
+  return `instr_counters[${groups[key].counters[name]}]`
+}
+
+let emitInc = (buf, counter) => {
+  if (counter) c.stmt(buf)(c.inc(counter))
+}
+
+// Phases are timed with instr_now() and accumulated, so a phase that runs
+// repeatedly (e.g. a sort in a loop) reports its total time.
+// Sorting is also part of the phase it runs in.
+let phaseIdx = (name) => phases.indexOf(name)
+
+let emitPhaseStart = (buf, name) => {
+  if (!enabled) return
+  c.stmt(buf)(`instr_phase_start[${phaseIdx(name)}] = instr_now()`)
+}
+
+let emitPhaseEnd = (buf, name) => {
+  if (!enabled) return
+  let i = phaseIdx(name)
+  c.stmt(buf)(`instr_phase_us[${i}] += instr_now() - instr_phase_start[${i}]`)
+}
+
+let emitDecls = (buf) => {
+  if (!enabled) return
+  c.stmt(buf)(`uint64_t instr_counters[${Math.max(numCounters, 1)}]`)
+  c.stmt(buf)(`uint64_t instr_phase_start[${Math.max(phases.length, 1)}]`)
+  c.stmt(buf)(`uint64_t instr_phase_us[${Math.max(phases.length, 1)}]`)
+}
+
+// In server mode each request reports its own counters and phases, only
+// the time to load the inputs (once, before the first request) is kept
+let emitRequestReset = (buf) => {
+  if (!enabled) return
+  c.stmt(buf)(c.call("memset", "instr_counters", "0", "sizeof(instr_counters)"))
+  phases.forEach((name, i) => {
+    if (name != "load") c.stmt(buf)(c.assign(`instr_phase_us[${i}]`, "0"))
+  })
+}
+
+// JSON string that can be part of a printf format
+let jsonStr = (str) => JSON.stringify(str).replace(/%/g, "%%")
+
+// Write the report as JSON. exprOf(kind, id) supplies the expression of
+// groups that were created without one (e.g. hashmaps named by their tmp)
+let emitReport = (buf, filename, exprOf) => {
+  if (!enabled) return
+  let f = "instr_file"
+  c.declarePtr(buf)("FILE", f, c.call("fopen", JSON.stringify(filename), "\"w\""))
+  c.if(buf)(f, buf1 => {
+    let fmt = `{"phases": {${phases.map(name => `${jsonStr(name)}: %lu`).join(", ")}}, "groups": [`
+    let args = phases.map((name, i) => `, (unsigned long)instr_phase_us[${i}]`).join("")
+    buf1.push(`fprintf(${f}, ${JSON.stringify(fmt)}${args});`)
+    Object.values(groups).forEach((g, k) => {
+      let expr = g.expr ?? exprOf(g.kind, g.id)
+      let head = `${k > 0 ? "," : ""}\n  {"kind": ${jsonStr(g.kind)}, "id": ${jsonStr(String(g.id))}` +
+        (expr !== undefined ? `, "expr": ${jsonStr(expr)}` : "")
+      let names = Object.keys(g.counters)
+      let fmt = head + `, "counters": {${names.map(name => `${jsonStr(name)}: %lu`).join(", ")}}}`
+      let args = names.map(name => `, (unsigned long)instr_counters[${g.counters[name]}]`).join("")
+      buf1.push(`fprintf(${f}, ${JSON.stringify(fmt)}${args});`)
+    })
+    buf1.push(`fprintf(${f}, "\\n]}\\n");`)
+    c.stmt(buf1)(c.call("fclose", f))
+  })
+}
+
+let instrument = {
+  reset,
+  isEnabled: () => enabled,
+  counter,
+  emitInc,
+  emitPhaseStart,
+  emitPhaseEnd,
+  emitDecls,
+  emitRequestReset,
+  emitReport
+}
+
+module.exports = {
+  instrument
+}
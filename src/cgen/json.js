@@ -18,7 +18,10 @@ let convertJSONTo = (json, schema) => {
     let len = c.call("yyjson_get_len", json.val)
     let cond = c.not(c.call("yyjson_is_str", json.val))
     if (json.cond) cond = c.or(json.cond, cond)
-    return value.string(schema, str, len, undefined, cond)
+    let res = value.string(schema, str, len, undefined, cond)
+    // strings of a streamed document do not outlive the iteration
+    if (json.transient) res.transient = true
+    return res
   } else if (typing.isNumber(schema)) {
     // Assume number
     let func1 = "yyjson_get_num"
@@ -135,7 +138,7 @@ let getNDJSONLoopTxt = (f, ndjson, data) => () => {
   let v = f.arg[1].op
   let info = [`// generator: ${v} <- ${pretty(f.arg[0])}`]
 
-  let { mappedFile, size } = ndjson.val
+  let { mappedFile, size, resident } = ndjson.val
 
   v = quoteVar(v)
 
@@ -148,7 +151,8 @@ let getNDJSONLoopTxt = (f, ndjson, data) => () => {
   let rowScanning = []
 
   let doc = symbol.getSymbol("tmp_doc")
-  c.declarePtr(rowScanning)("yyjson_doc", doc, c.call("yyjson_read_opts", c.add(mappedFile, cursor), c.sub(size, cursor), "YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE", "NULL", "NULL"))
+  let flags = resident ? "YYJSON_READ_STOP_WHEN_DONE" : "YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE"
+  c.declarePtr(rowScanning)("yyjson_doc", doc, c.call("yyjson_read_opts", c.add(mappedFile, cursor), c.sub(size, cursor), flags, "NULL", "NULL"))
 
   c.if(rowScanning)(c.not(doc), buf1 => {
     c.break(buf1)()
@@ -168,13 +172,65 @@ let getNDJSONLoopTxt = (f, ndjson, data) => () => {
   }
 }
 
+// Iterate over the elements of a top-level JSON array without reading the
+// whole document. The stream is opened for every loop that uses it and each
+// element is parsed into its own yyjson document that is freed after the
+// iteration.
+let getJSONStreamLoopTxt = (f, stream, data, bufferSize) => () => {
+  let v = f.arg[1].op
+  let info = [`// generator: ${v} <- ${pretty(f.arg[0])}`]
+
+  let { filename } = stream.val
+
+  v = quoteVar(v)
+
+  let initCursor = []
+
+  let js = symbol.getSymbol("json_stream")
+  c.declareVar(initCursor)("json_stream", js)
+  c.if(initCursor)(c.ne(c.call("json_stream_open", `&${js}`, filename, bufferSize), "0"), buf1 => {
+    c.printErr(buf1)("Unable to open %s as a JSON array\\n", filename)
+    c.return(buf1)("1")
+  })
+
+  let loopHeader = [`for (int ${v} = 0; ; ${v}++) {`]
+  let rowScanning = []
+
+  let elem = symbol.getSymbol("tmp_elem")
+  let len = symbol.getSymbol("tmp_elem_len")
+  c.declareConstCharPtr(rowScanning)(elem)
+  c.declareSize(rowScanning)(len)
+  c.if(rowScanning)(c.not(c.call("json_stream_next", `&${js}`, `&${elem}`, `&${len}`)), buf1 => {
+    c.break(buf1)()
+  })
+
+  let doc = symbol.getSymbol("tmp_doc")
+  c.declarePtr(rowScanning)("yyjson_doc", doc, c.call("yyjson_read_opts", c.cast("char *", elem), len, "0", "NULL", "NULL"))
+
+  c.if(rowScanning)(c.not(doc), buf1 => {
+    c.printErr(buf1)("read error in element %d of %s\\n", v, filename)
+    c.stmt(buf1)(c.call("json_stream_close", `&${js}`))
+    c.break(buf1)()
+  })
+
+  let jsonVal = v + "_gen"
+  c.declarePtr(rowScanning)("yyjson_val", jsonVal, c.call("yyjson_doc_get_root", doc))
+
+  let epilog = [`yyjson_doc_free(${doc});`]
+
+  return {
+    info, data, initCursor, loopHeader, boundsChecking: [], rowScanning, epilog
+  }
+}
+
 let json = {
   convertJSONTo,
   emitLoadJSON,
   emitLoadNDJSON,
   getJSONObjLoopTxt,
   getJSONArrayLoopTxt,
-  getNDJSONLoopTxt
+  getNDJSONLoopTxt,
+  getJSONStreamLoopTxt
 }
 
 module.exports = {
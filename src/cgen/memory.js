@@ -0,0 +1,103 @@
+const { c } = require("./utils")
+
+// Memory accounting for settings.memoryStats.
+//
+// Every buffer allocated for a hashmap or array goes through mem_track (see
+// rhyme-c.h), which adds its size to the registry entry of the buffer. At
+// exit the binary writes a JSON report with the bytes reserved and the bytes
+// used (entries in use × entry size) per buffer, grouped by the structure
+// that owns it, and the peak RSS of the process:
+//
+//   { "peakRss": 4194304, "reserved": 3072, "used": 96,
+//     "structures": [{ "id": "tmp1", "expr": "...", "reserved": 3072, "used": 96,
+//                      "buffers": [{ "name": "keys0", "entrySize": 4, "allocations": 1,
+//                                    "reserved": 1024, "used": 32 }, ...] }] }
+//
+// Buffers of nested hashmaps are allocated per key, their use is reported as null.
+
+let enabled
+let entries
+
+let reset = (settings) => {
+  enabled = settings.memoryStats || false
+  entries = []
+}
+
+// Wrap the allocation of size entries of type for the buffer named
+// <owner>_<name>. count is the number of entries in use at exit, if known.
+let track = (buf, alloc, bufName, type, size, count) => {
+  if (!enabled) return alloc
+  let i = bufName.indexOf("_")
+  let id = entries.length
+  entries.push({ owner: bufName.substring(0, i), name: bufName.substring(i + 1), type, count, buf })
+  return c.call("mem_track", `&mem_registry[${id}]`, alloc, `sizeof(${type}) * ${size}`)
+}
+
+let emitDecls = (buf) => {
+  if (!enabled) return
+  c.stmt(buf)(`mem_entry mem_registry[${Math.max(entries.length, 1)}]`)
+}
+
+// In server mode the per-request structures are allocated again for each
+// request, only the ones allocated while loading the inputs are kept
+let emitRequestReset = (buf, resident) => {
+  if (!enabled) return
+  entries.forEach((e, id) => {
+    if (e.buf !== resident) c.stmt(buf)(`mem_registry[${id}] = (mem_entry){ 0 }`)
+  })
+}
+
+let jsonStr = (str) => JSON.stringify(str).replace(/%/g, "%%")
+
+let emitReport = (buf, filename, exprOf) => {
+  if (!enabled) return
+  let f = "mem_file"
+  let used = (id) => `mem_used[${id}]`
+  c.stmt(buf)(`size_t mem_used[${Math.max(entries.length, 1)}]`)
+  entries.forEach((e, id) => {
+    if (e.count !== undefined) c.stmt(buf)(c.assign(used(id), `(size_t)${e.count} * sizeof(${e.type})`))
+  })
+
+  let owners = {}
+  entries.forEach((e, id) => (owners[e.owner] ??= []).push(id))
+
+  let sum = (ids, field) => ids.length ? ids.map(field).join(" + ") : "0"
+  let reserved = (id) => `mem_registry[${id}].reserved`
+  let known = (ids) => ids.filter(id => entries[id].count !== undefined)
+  let all = entries.map((e, id) => id)
+
+  c.declarePtr(buf)("FILE", f, c.call("fopen", JSON.stringify(filename), "\"w\""))
+  c.if(buf)(f, buf1 => {
+    buf1.push(`fprintf(${f}, "{\\"peakRss\\": %zu, \\"reserved\\": %zu, \\"used\\": %zu, \\"structures\\": [", mem_peak_rss(), (size_t)(${sum(all, reserved)}), (size_t)(${sum(known(all), used)}));`)
+    Object.entries(owners).forEach(([owner, ids], k) => {
+      let expr = exprOf(owner)
+      let head = `${k > 0 ? "," : ""}\n  {"id": ${jsonStr(owner)}` + (expr !== undefined ? `, "expr": ${jsonStr(expr)}` : "") +
+        `, "reserved": %zu, "used": %zu, "buffers": [`
+      buf1.push(`fprintf(${f}, ${JSON.stringify(head)}, (size_t)(${sum(ids, reserved)}), (size_t)(${sum(known(ids), used)}));`)
+      ids.forEach((id, j) => {
+        let e = entries[id]
+        let fmt = `${j > 0 ? ", " : ""}{"name": ${jsonStr(e.name)}, "entrySize": %zu, "allocations": %zu, "reserved": %zu, "used": ` +
+          (e.count !== undefined ? "%zu}" : "null}")
+        let args = [`sizeof(${e.type})`, `mem_registry[${id}].allocations`, reserved(id)]
+        if (e.count !== undefined) args.push(used(id))
+        buf1.push(`fprintf(${f}, ${JSON.stringify(fmt)}, ${args.join(", ")});`)
+      })
+      buf1.push(`fprintf(${f}, "]}");`)
+    })
+    buf1.push(`fprintf(${f}, "\\n]}\\n");`)
+    c.stmt(buf1)(c.call("fclose", f))
+  })
+}
+
+let memory = {
+  reset,
+  isEnabled: () => enabled,
+  track,
+  emitDecls,
+  emitRequestReset,
+  emitReport
+}
+
+module.exports = {
+  memory
+}
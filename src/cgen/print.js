@@ -8,24 +8,34 @@ const { typing, typeSyms } = require("../typing")
 const { symbol } = require("./symbol")
 
 let emitStringPrint = (buf, val, settings) => {
-  if (settings.format == "json")
-    c.printf(buf)(`\\"%.*s\\"`, val.val.len, val.val.str)
-  else
-    c.printf(buf)(`%.*s`, val.val.len, val.val.str)
+  if (settings.format == "json") {
+    c.outLit(buf)("\"")
+    c.outStr(buf)(val.val.str, val.val.len)
+    c.outLit(buf)("\"")
+  } else {
+    c.outStr(buf)(val.val.str, val.val.len)
+  }
+}
+
+// Non-string keys are quoted in JSON
+let emitKeyPrint = (buf, key) => {
+  c.outLit(buf)("\"")
+  c.outVal(buf)(key.schema, key.val)
+  c.outLit(buf)("\"")
 }
 
 let emitObjectPrintJSON = (buf, val, settings) => {
-  c.printf(buf)("{");
+  c.outLit(buf)("{");
   for (let i in Object.keys(val.val)) {
     let k = Object.keys(val.val)[i]
     let v = val.val[k]
-    c.printf(buf)(`\\"${k}\\":`)
+    c.outLit(buf)(`"${k}":`)
     emitValPrint(buf, v, settings)
     if (i != Object.keys(val.val).length - 1) {
-      c.printf(buf)(",")
+      c.outLit(buf)(",")
     }
   }
-  c.printf(buf)("}");
+  c.outLit(buf)("}");
 }
 
 let emitObjectPrint = (buf, obj, settings) => {
@@ -36,28 +46,60 @@ let emitObjectPrint = (buf, obj, settings) => {
   for (let k in obj.val) {
     let v = obj.val[k]
     emitValPrint(buf, v, settings)
-    c.printf(buf)("|");
+    c.outLit(buf)("|");
   }
 }
 
+// Position of the next entry of a sorted collection, read from the merge of
+// an external sort that is streamed into the print loop (val.merge)
+let getSortedPos = (v, sym) => v.val.merge ? c.call("sort_merge_next", "&" + v.val.merge) : `${sym}[i]`
+
+// Release the runs of the merge once the loop is done
+let emitSortMergeFree = (buf, v) => {
+  if (v.val.merge) c.stmt(buf)(c.call("sort_merge_free", "&" + v.val.merge))
+}
+
 // Emit code that prints the keys and values in a hashmap.
 let emitHashMapPrintJSON = (buf, map, settings) => {
   let sym = tmpSym(map.val.sym)
   let count = map.val.count
   let limit = settings.limit ? c.ternary(c.lt(settings.limit, count), settings.limit, count) : count
 
-  c.printf(buf)("{")
+  c.outLit(buf)("{")
 
   buf.push(`for (int i = 0; i < ${limit}; i++) {`)
   if (map.val.sorted) {
-    buf.push(`int key_pos = ${sym}[i];`)
+    buf.push(`int key_pos = ${getSortedPos(map, sym)};`)
   } else {
     buf.push(`int key_pos = i + 1;`)
   }
 
 
-  let loopVar = map.val.sorted ? "i" : "key_pos"
+  emitHashMapEntryPrintJSON(buf, map, settings)
+
+  buf.push(`if (i != ${limit} - 1) {`)
+  c.outLit(buf)(",")
+  buf.push(`}`)
+
+  buf.push(`}`)
+  emitSortMergeFree(buf, map)
 
+  c.outLit(buf)("}")
+}
+
+// Emit code that prints the entries of a hashmap that holds one partition of
+// the result, printed counts the entries printed before
+let emitHashMapPartPrintJSON = (buf, map, settings, printed) => {
+  buf.push(`for (int key_pos = 1; key_pos <= ${map.val.count}; key_pos++) {`)
+  buf.push(`if (${printed}++ > 0) {`)
+  c.outLit(buf)(",")
+  buf.push(`}`)
+  emitHashMapEntryPrintJSON(buf, map, settings)
+  buf.push(`}`)
+}
+
+// Emit code that prints the key and value at key_pos
+let emitHashMapEntryPrintJSON = (buf, map, settings) => {
   buf.push(`// print key`)
   for (let i in map.val.keys) {
     let key = JSON.parse(JSON.stringify(map.val.keys[i]))
@@ -70,25 +112,16 @@ let emitHashMapPrintJSON = (buf, map, settings) => {
       emitStringPrint(buf, key, settings)
     } else {
       key.val += "[key_pos]"
-      // Add quotes around non-string keys
-      c.printf(buf)(`\\"%${utils.getFormatSpecifier(key.schema)}\\"`, key.val)
+      emitKeyPrint(buf, key)
     }
   }
 
-  c.printf(buf)(":")
+  c.outLit(buf)(":")
 
   buf.push(`// print value`)
 
   let value = hashmap.getHashMapValueEntry(map, undefined, "key_pos")
   emitValPrint(buf, value, settings)
-
-  buf.push(`if (i != ${limit} - 1) {`)
-  c.printf(buf)(",")
-  buf.push(`}`)
-
-  buf.push(`}`)
-
-  c.printf(buf)("}")
 }
 
 // Emit code that prints the keys and values in a hashmap.
@@ -103,7 +136,7 @@ let emitHashMapPrint = (buf, map, settings) => {
 
   buf.push(`for (int i = 0; i < ${limit}; i++) {`)
   if (map.val.sorted) {
-    buf.push(`int key_pos = ${sym}[i];`)
+    buf.push(`int key_pos = ${getSortedPos(map, sym)};`)
   } else {
     buf.push(`int key_pos = i + 1;`)
   }
@@ -114,10 +147,11 @@ let emitHashMapPrint = (buf, map, settings) => {
   emitValPrint(buf, value, settings)
 
   buf.push(`if (i != ${limit} - 1) {`)
-  c.printf(buf)("\\n")
+  c.outLit(buf)("\n")
   buf.push(`}`)
 
   buf.push(`}`)
+  emitSortMergeFree(buf, map)
 }
 
 // Emit code that prints the keys and values in a hashmap.
@@ -129,7 +163,7 @@ let emitNestedHashMapPrint = (buf, map, settings) => {
   let count = map.val.count
   let limit = count
 
-  c.printf(buf)("{")
+  c.outLit(buf)("{")
 
   let loopVar = symbol.getSymbol("key_pos")
   buf.push(`for (int ${loopVar} = 1; ${loopVar} <= ${limit}; ${loopVar}++) {`)
@@ -147,12 +181,11 @@ let emitNestedHashMapPrint = (buf, map, settings) => {
       emitStringPrint(buf, key, settings)
     } else {
       key.val += indexing
-      // Add quotes around non-string keys
-      c.printf(buf)(`\\"%${utils.getFormatSpecifier(key.schema)}\\"`, key.val)
+      emitKeyPrint(buf, key)
     }
   }
 
-  c.printf(buf)(":")
+  c.outLit(buf)(":")
 
   buf.push(`// print value`)
 
@@ -160,12 +193,12 @@ let emitNestedHashMapPrint = (buf, map, settings) => {
   emitValPrint(buf, value, settings)
 
   buf.push(`if (${loopVar} != ${limit}) {`)
-  c.printf(buf)(",")
+  c.outLit(buf)(",")
   buf.push(`}`)
 
   buf.push(`}`)
 
-  c.printf(buf)("}")
+  c.outLit(buf)("}")
 }
 
 let emitArrayPrintJSON = (buf, arr, settings) => {
@@ -173,10 +206,10 @@ let emitArrayPrintJSON = (buf, arr, settings) => {
   let count = arr.val.count
   let limit = settings.limit ? c.ternary(c.lt(settings.limit, count), settings.limit, count) : count
 
-  c.printf(buf)("[")
+  c.outLit(buf)("[")
   if (arr.val.sorted) {
     buf.push(`for (int i = 0; i < ${limit}; i++) {`)
-    buf.push(`int idx = ${sym}[i];`)
+    buf.push(`int idx = ${getSortedPos(arr, sym)};`)
   } else {
     buf.push(`for (int idx = 0; idx < ${limit}; idx++) {`)
   }
@@ -187,10 +220,11 @@ let emitArrayPrintJSON = (buf, arr, settings) => {
   emitValPrint(buf, value, settings)
 
   buf.push(`if (${loopVar} != ${limit} - 1) {`)
-  c.printf(buf)(",")
+  c.outLit(buf)(",")
   buf.push(`}`)
   buf.push(`}`)
-  c.printf(buf)("]")
+  emitSortMergeFree(buf, arr)
+  c.outLit(buf)("]")
 }
 
 let emitArrayPrint = (buf, arr, settings) => {
@@ -204,7 +238,7 @@ let emitArrayPrint = (buf, arr, settings) => {
 
   if (arr.val.sorted) {
     buf.push(`for (int i = 0; i < ${limit}; i++) {`)
-    buf.push(`int idx = ${sym}[i];`)
+    buf.push(`int idx = ${getSortedPos(arr, sym)};`)
   } else {
     buf.push(`for (int idx = 0; idx < ${limit}; idx++) {`)
   }
@@ -215,24 +249,25 @@ let emitArrayPrint = (buf, arr, settings) => {
   emitValPrint(buf, value, settings)
 
   buf.push(`if (${loopVar} != ${limit} - 1) {`)
-  c.printf(buf)("\\n")
+  c.outLit(buf)("\n")
   buf.push(`}`)
   buf.push(`}`)
+  emitSortMergeFree(buf, arr)
 }
 
 let emitHashMapBucketPrint = (buf, bucket, settings) => {
   let bucketCount = bucket.val.bucketCount
-  c.printf(buf)("[")
+  c.outLit(buf)("[")
   buf.push(`for (int idx = 0; idx < ${bucketCount}; idx++) {`)
 
   let value = array.getValueAtIdx(bucket, "idx")
   emitValPrint(buf, value, settings)
 
   buf.push(`if (idx != ${bucketCount} - 1) {`)
-  c.printf(buf)(",")
+  c.outLit(buf)(",")
   buf.push(`}`)
   buf.push(`}`)
-  c.printf(buf)("]")
+  c.outLit(buf)("]")
 }
 
 let emitHashMapLinkedBucketPrintJSON = (buf, bucket, settings) => {
@@ -241,17 +276,17 @@ let emitHashMapLinkedBucketPrintJSON = (buf, bucket, settings) => {
     return
   }
 
-  c.printf(buf)("[")
+  c.outLit(buf)("[")
   buf.push(`for (int idx = ${bucket.val.head}; idx != 0; idx = ${bucket.val.prev}[idx]) {`)
 
   let value = array.getValueAtIdx(bucket, "idx")
   emitValPrint(buf, value, settings)
 
   buf.push(`if (${bucket.val.prev}[idx] != 0) {`)
-  c.printf(buf)(",")
+  c.outLit(buf)(",")
   buf.push(`}`)
   buf.push(`}`)
-  c.printf(buf)("]")
+  c.outLit(buf)("]")
 }
 
 let emitHashMapLinkedBucketPrint = (buf, bucket, settings) => {
@@ -266,7 +301,7 @@ let emitHashMapLinkedBucketPrint = (buf, bucket, settings) => {
   emitValPrint(buf, value, settings)
 
   buf.push(`if (${bucket.val.prev}[idx] != 0) {`)
-  c.printf(buf)("\\n")
+  c.outLit(buf)("\n")
   buf.push(`}`)
   buf.push(`}`)
 }
@@ -282,7 +317,10 @@ let emitValPrint = (buf, val, settings) => {
       emitArrayPrint(buf1, val, settings)
     } else if (val.tag == TAG.JSON) {
       c.comment(buf1)("print json object")
-      c.printf(buf1)("%s", c.call("yyjson_val_write", val.val, "0", "NULL"))
+      let json = symbol.getSymbol("tmp_json")
+      c.declareCharPtr(buf1)(json, c.call("yyjson_val_write", val.val, "0", "NULL"))
+      c.outStr(buf1)(json, c.call("strlen", json))
+      c.stmt(buf1)(c.call("free", json))
     } else if (val.tag == TAG.OBJECT) {
       c.comment(buf1)("print object")
       emitObjectPrint(buf1, val, settings)
@@ -297,18 +335,14 @@ let emitValPrint = (buf, val, settings) => {
       emitNestedHashMapPrint(buf1, val, settings)
     } else if (typing.isString(val.schema)) {
       emitStringPrint(buf1, val, settings)
-    } else if (val.schema.typeSym == typeSyms.date) {
-      buf1.push(`print_date(${val.val});`)
-    } else if (val.schema.typeSym == typeSyms.boolean) {
-      c.printf(buf1)(`%s`, c.ternary(val.val, `"true"`, `"false"`))
     } else {
-      c.printf(buf1)(`%${utils.getFormatSpecifier(val.schema)}`, val.val)
+      c.outVal(buf1)(val.schema, val.val)
     }
   }
   if (val.cond) {
     if (val.cond) {
       c.if(buf)(val.cond, buf1 => {
-        c.printf(buf1)("null")
+        c.outLit(buf1)("null")
       }, f)
     }
   } else {
@@ -318,7 +352,8 @@ let emitValPrint = (buf, val, settings) => {
 }
 
 let printEmitter = {
-  emitValPrint
+  emitValPrint,
+  emitHashMapPartPrintJSON
 }
 
 module.exports = {
@@ -0,0 +1,72 @@
+const os = require("child_process")
+
+// Host side of the resident server mode (settings.server).
+// The compiled binary loads its inputs once and then answers one request per
+// line written to its stdin. A request is the tab-separated list of parameter
+// values, the response is a sequence of <u32 length><data> chunks that ends
+// with an empty chunk.
+
+class QueryServer {
+  constructor(binary) {
+    this.binary = binary
+    this.child = os.spawn(binary, [], { stdio: ["pipe", "pipe", "ignore"] })
+    this.pending = []
+    this.chunks = []
+    this.input = Buffer.alloc(0)
+    this.exited = undefined
+
+    this.child.stdout.on("data", data => this.receive(data))
+    this.child.on("error", err => this.fail(err))
+    this.child.stdin.on("error", err => this.fail(err))
+    this.child.on("close", code => this.fail(new Error(`Query server ${binary} exited (exit code ${code})`)))
+  }
+
+  receive(data) {
+    this.input = this.input.length > 0 ? Buffer.concat([this.input, data]) : data
+    let pos = 0
+    while (this.input.length - pos >= 4) {
+      let len = this.input.readUInt32LE(pos)
+      if (this.input.length - pos - 4 < len) break
+      if (len == 0) {
+        let res = Buffer.concat(this.chunks)
+        this.chunks = []
+        this.pending.shift().resolve(res)
+      } else {
+        this.chunks.push(this.input.subarray(pos + 4, pos + 4 + len))
+      }
+      pos += 4 + len
+    }
+    this.input = this.input.subarray(pos)
+  }
+
+  fail(err) {
+    this.exited ??= err
+    for (let p of this.pending) p.reject(err)
+    this.pending = []
+  }
+
+  // Run the query with the given parameter values, resolves to the raw output
+  request(args) {
+    if (this.exited) return Promise.reject(this.exited)
+    for (let arg of args) {
+      if (arg.includes("\t") || arg.includes("\n"))
+        return Promise.reject(new Error("Query parameters sent to a server cannot contain tabs or newlines"))
+    }
+    return new Promise((resolve, reject) => {
+      this.pending.push({ resolve, reject })
+      this.child.stdin.write(args.join("\t") + "\n")
+    })
+  }
+
+  close() {
+    this.child.stdin.end()
+  }
+}
+
+let server = {
+  QueryServer
+}
+
+module.exports = {
+  server
+}
@@ -0,0 +1,202 @@
+const fs = require("fs")
+const path = require("path")
+const { StringDecoder } = require("string_decoder")
+const { typing, typeSyms } = require('../typing')
+const { utils } = require("./utils")
+
+// Columnar ("shredded") copy of an NDJSON file.
+//
+// Every scalar path of the record schema (e.g. commit.collection) gets its own
+// set of files in the column directory:
+//   <path>.def  definition bits, bit i is set if row i has a value of the expected type
+//   <path>.val  fixed-width values (numbers), one per row
+//   <path>.off  u64 offsets into <path>.str, rows + 1 entries (strings)
+//   <path>.str  concatenated utf-8 string bytes (strings)
+// rows.bin holds the row count as a u64 and meta.json describes the layout.
+// Paths with a type that cannot be stored in a column (e.g. unknown) are skipped.
+
+let columnArrays = {
+  [typeSyms.boolean]: Int32Array,
+  [typeSyms.u8]: Uint8Array,
+  [typeSyms.u16]: Uint16Array,
+  [typeSyms.u32]: Uint32Array,
+  [typeSyms.u64]: BigUint64Array,
+  [typeSyms.i8]: Int8Array,
+  [typeSyms.i16]: Int16Array,
+  [typeSyms.i32]: Int32Array,
+  [typeSyms.i64]: BigInt64Array,
+  [typeSyms.f32]: Float32Array,
+  [typeSyms.f64]: Float64Array,
+  [typeSyms.date]: Int32Array,
+}
+
+// Same acceptance rules as the yyjson accessors used by the row-based path
+let isUnsigned = t => t == typeSyms.u8 || t == typeSyms.u16 || t == typeSyms.u32 || t == typeSyms.u64
+let isSigned = t => t == typeSyms.i8 || t == typeSyms.i16 || t == typeSyms.i32 || t == typeSyms.i64 || t == typeSyms.date
+
+let accepts = (schema, v) => {
+  if (typing.isString(schema)) return typeof v == "string"
+  if (schema.typeSym == typeSyms.boolean) return typeof v == "boolean"
+  if (typeof v != "number") return false
+  if (isUnsigned(schema.typeSym)) return Number.isInteger(v) && v >= 0
+  if (isSigned(schema.typeSym)) return Number.isInteger(v)
+  return true
+}
+
+let defaultColumnDir = (filename) => filename + ".cols"
+
+let columnName = (p) => p.join(".")
+
+// Collect the scalar paths of a record schema that can be stored as columns
+let getColumnPaths = (schema, prefix = []) => {
+  let res = []
+  for (let { name, schema: s } of utils.convertToArrayOfSchema(schema)) {
+    if (typing.isUnknown(s)) continue
+    if (typing.isObject(s) && utils.isSimpleObject(s)) {
+      res.push(...getColumnPaths(s, [...prefix, name]))
+    } else if (typing.isString(s) || s.typeSym in columnArrays) {
+      res.push({ path: [...prefix, name], schema: s })
+    }
+  }
+  return res
+}
+
+let chunkRows = 1 << 16
+
+class ColumnWriter {
+  constructor(dir, { path: p, schema }) {
+    this.path = p
+    this.schema = schema
+    this.isString = typing.isString(schema)
+    let base = path.join(dir, columnName(p))
+    this.defFd = fs.openSync(base + ".def", "w")
+    this.def = new Uint8Array(chunkRows / 8)
+    if (this.isString) {
+      this.offFd = fs.openSync(base + ".off", "w")
+      this.strFd = fs.openSync(base + ".str", "w")
+      this.off = new BigUint64Array(chunkRows)
+      this.strs = []
+      this.strLen = 0
+      this.written = 0
+      // leading zero offset, so that row i spans off[i] .. off[i + 1]
+      fs.writeSync(this.offFd, new BigUint64Array(1))
+    } else {
+      this.valFd = fs.openSync(base + ".val", "w")
+      this.vals = new columnArrays[schema.typeSym](chunkRows)
+    }
+    this.n = 0
+  }
+
+  add(v) {
+    let i = this.n++
+    let defined = v !== undefined && v !== null && accepts(this.schema, v)
+    if (defined) this.def[i >> 3] |= 1 << (i & 7)
+    if (this.isString) {
+      if (defined) {
+        let bytes = Buffer.from(v, "utf8")
+        this.strs.push(bytes)
+        this.strLen += bytes.length
+      }
+      this.off[i] = BigInt(this.written + this.strLen)
+    } else if (defined) {
+      let val = typeof v == "boolean" ? Number(v) : v
+      this.vals[i] = this.vals instanceof BigInt64Array || this.vals instanceof BigUint64Array ? BigInt(Math.trunc(val)) : val
+    }
+    if (this.n == chunkRows) this.flush()
+  }
+
+  flush() {
+    let n = this.n
+    fs.writeSync(this.defFd, this.def, 0, Math.ceil(n / 8))
+    this.def.fill(0)
+    if (this.isString) {
+      fs.writeSync(this.offFd, this.off.subarray(0, n))
+      if (this.strs.length > 0) fs.writeSync(this.strFd, Buffer.concat(this.strs, this.strLen))
+      this.written += this.strLen
+      this.strs = []
+      this.strLen = 0
+    } else {
+      fs.writeSync(this.valFd, this.vals.subarray(0, n))
+      this.vals.fill(this.vals instanceof BigInt64Array || this.vals instanceof BigUint64Array ? 0n : 0)
+    }
+    this.n = 0
+  }
+
+  close() {
+    this.flush()
+    for (let fd of [this.defFd, this.offFd, this.strFd, this.valFd])
+      if (fd !== undefined) fs.closeSync(fd)
+  }
+}
+
+// Call f with each non-blank line of the file, read in chunks. The decoder
+// keeps the bytes of a character split across two chunks for the next one.
+let splitLines = (filename, f, chunkSize = 64 * 1024 * 1024) => {
+  let fd = fs.openSync(filename, "r")
+  let buf = Buffer.alloc(chunkSize)
+  let decoder = new StringDecoder("utf8")
+  let leftover = ""
+  let bytesRead
+  while ((bytesRead = fs.readSync(fd, buf, 0, chunkSize)) > 0) {
+    let lines = (leftover + decoder.write(buf.subarray(0, bytesRead))).split("\n")
+    leftover = lines.pop()
+    for (let line of lines) {
+      if (line.trim()) f(line)
+    }
+  }
+  leftover += decoder.end()
+  if (leftover.trim()) f(leftover)
+  fs.closeSync(fd)
+}
+
+// Convert an NDJSON file into column files. schema is the type passed to
+// loadNDJSON (an array of records) or the record type itself.
+// Returns the metadata written to meta.json.
+let shredNDJSON = (filename, schema, dir = defaultColumnDir(filename)) => {
+  let record = typing.isNumber(schema.objKey) ? schema.objValue : schema
+  let columns = getColumnPaths(record)
+
+  fs.mkdirSync(dir, { recursive: true })
+  let writers = columns.map(col => new ColumnWriter(dir, col))
+
+  let rows = 0
+  let addRecord = line => {
+    let obj = JSON.parse(line)
+    for (let w of writers) {
+      let v = obj
+      for (let k of w.path) {
+        v = v?.[k]
+      }
+      w.add(v)
+    }
+    rows++
+  }
+
+  splitLines(filename, addRecord)
+
+  writers.forEach(w => w.close())
+  fs.writeFileSync(path.join(dir, "rows.bin"), new BigUint64Array([BigInt(rows)]))
+
+  let stat = fs.statSync(filename)
+  let meta = {
+    source: filename,
+    size: stat.size,
+    mtimeMs: stat.mtimeMs,
+    rows,
+    columns: columns.map(({ path: p, schema }) => ({ path: p, type: typing.prettyPrintType(schema) }))
+  }
+  fs.writeFileSync(path.join(dir, "meta.json"), JSON.stringify(meta, null, 2))
+  return meta
+}
+
+let shred = {
+  defaultColumnDir,
+  columnName,
+  getColumnPaths,
+  splitLines,
+  shredNDJSON
+}
+
+module.exports = {
+  shred
+}
@@ -138,9 +138,23 @@ c.struct = (name) => ({
   }
 })
 
-c.printf = (buf) => (fmt, ...args) => buf.push(c.call("printf", "\"" + fmt + "\"", ...args) + ";")
+// Formatted output goes to the same buffer as the out_* writers
+c.printf = (buf) => (fmt, ...args) => buf.push(c.call("out_printf", "\"" + fmt + "\"", ...args) + ";")
 c.printErr = (buf) => (fmt, ...args) => buf.push(c.call("fprintf", "stderr", "\"" + fmt + "\"", ...args) + ";")
 
+// Buffered result output, see out_* in rhyme-c.h
+// outLit takes the unescaped text of a constant
+c.outLit = (buf) => (s) => {
+  if (s.length == 1) {
+    let ch = s == "'" || s == "\\" ? "\\" + s : s == "\n" ? "\\n" : s
+    buf.push(c.call("out_char", `'${ch}'`) + ";")
+  } else {
+    buf.push(c.call("out_str", JSON.stringify(s), new TextEncoder().encode(s).length) + ";")
+  }
+}
+c.outStr = (buf) => (str, len) => buf.push(c.call("out_str", str, len) + ";")
+c.outVal = (buf) => (type, val) => buf.push(getOutCall(type, val) + ";")
+
 c.if = (buf) => (cond, tBranch, fBranch) => {
   buf.push(`if (${cond}) {`)
   tBranch(buf)
@@ -185,6 +199,36 @@ let getFormatSpecifier = (type) => {
   throw new Error("Unknown type: " + typing.prettyPrintType(type))
 }
 
+let outFunctionMap = {
+  boolean: "out_bool",
+  u8: "out_uint",
+  u16: "out_uint",
+  u32: "out_uint",
+  u64: "out_uint",
+  i8: "out_int",
+  i16: "out_int",
+  i32: "out_int",
+  i64: "out_int",
+  char: "out_char",
+  date: "out_date"
+}
+
+// Decimal places of floating point output, same as getFormatSpecifier
+let outPrecisionMap = {
+  f32: 3,
+  f64: 4
+}
+
+let getOutCall = (type, val) => {
+  if (type.typeSym === "dynkey")
+    return getOutCall(type.keySupertype, val)
+  if (type.typeSym in outPrecisionMap)
+    return c.call("out_double", val, outPrecisionMap[type.typeSym])
+  if (type.typeSym in outFunctionMap)
+    return c.call(outFunctionMap[type.typeSym], val)
+  throw new Error("Unknown type: " + typing.prettyPrintType(type))
+}
+
 let convertToArrayOfSchema = (schema) => {
   if (schema.objKey === null) {
     return []
@@ -310,6 +354,16 @@ let stringToHexBytes = (str) => {
   return hex
 }
 
+// Store a string value into a persistent slot.
+// Strings pointing into a transient buffer (e.g. an element of a streamed
+// JSON array that is freed after the iteration) are copied into the string
+// arena first.
+let emitStoreString = (buf, lhs, rhs) => {
+  let str = rhs.transient ? c.call("str_arena_copy", rhs.val.str, rhs.val.len) : rhs.val.str
+  c.stmt(buf)(c.assign(lhs.str, str))
+  c.stmt(buf)(c.assign(lhs.len, rhs.val.len))
+}
+
 let internalError = (msg) => {
   throw new Error("Internal: " + msg)
 }
@@ -326,6 +380,7 @@ let utils = {
   emitWildcardMatch,
   getDataTypeLimits,
   stringToHexBytes,
+  emitStoreString,
   internalError
 }
 
@@ -7,6 +7,8 @@
 // HashMap bucket: { schema, val: { dataCount, bucketCount, buckets, valArray, valSchema }, tag: "hashMapBucket" }
 // Object: { schema: [...], val: { <key>: <val>, ... }, tag: "object" }
 // File input: { schema, val: mappedFile, tag: "inputFile" }
+// Streamed JSON array: { schema, val: { filename }, tag: "json_stream" }
+// Shredded NDJSON: { schema, val: { rows, columns }, tag: "columnar" }
 // C values will have a keyPos property if it is a result from hash lookup
 //
 // C values could have the optional "cond" property
@@ -22,6 +24,8 @@ const TAG = {
   CSV: "csv",
   JSON: "json",
   NDJSON: "ndjson",
+  JSON_STREAM: "json_stream",
+  COLUMNAR: "columnar",
   COMBINED_KEY: "combined_key",
   NESTED_HASHMAP: "nested_hashap"
 }
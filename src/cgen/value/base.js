@@ -97,7 +97,10 @@ class CJSON extends CValue {
 
   printJSON(buf) {
     c.comment(buf)("print json object")
-    c.printf(buf)("%s", c.call("yyjson_val_write", this.val, "0", "NULL"))
+    let json = symbol.getSymbol("tmp_json")
+    c.declareCharPtr(buf)(json, c.call("yyjson_val_write", this.val, "0", "NULL"))
+    c.outStr(buf)(json, c.call("strlen", json))
+    c.stmt(buf)(c.call("free", json))
   }
 }
 
@@ -130,15 +133,9 @@ class CPrim extends CBasicValue {
   }
 
   printJSON(buf, quoted) {
-    if (this.schema.typeSym == typeSyms.date) {
-      if (quoted) c.printf(buf)("\\\"")
-      c.stmt(buf)(c.call("print_date", this.val))
-      if (quoted) c.printf(buf)("\\\"")
-    } else if (quoted) {
-      c.printf(buf)(`\\"%${utils.getFormatSpecifier(this.schema)}\\"`, this.val)
-    } else {
-      c.printf(buf)(`%${utils.getFormatSpecifier(this.schema)}`, this.val)
-    }
+    if (quoted) c.outLit(buf)("\"")
+    c.outVal(buf)(this.schema, this.val)
+    if (quoted) c.outLit(buf)("\"")
   }
 
   print(buf) {
@@ -179,11 +176,13 @@ class CString extends CBasicValue {
   }
 
   printJSON(buf) {
-    c.printf(buf)(`\\"%.*s\\"`, this.len, this.str)
+    c.outLit(buf)("\"")
+    c.outStr(buf)(this.str, this.len)
+    c.outLit(buf)("\"")
   }
 
   print(buf) {
-    c.printf(buf)(`%.*s`, this.len, this.str)
+    c.outStr(buf)(this.str, this.len)
   }
 }
 
@@ -241,7 +240,7 @@ class CCompoundValue extends CBasicValue {
     for (let k in this.values) {
       let v = this.values[k]
       v.print(buf)
-      c.printf(buf)("|");
+      c.outLit(buf)("|");
     }
   }
 }
@@ -256,17 +255,17 @@ class CObject extends CCompoundValue {
   }
 
   printJSON(buf) {
-    c.printf(buf)("{");
+    c.outLit(buf)("{");
     for (let i in Object.keys(this.values)) {
       let k = Object.keys(this.values)[i]
       let v = this.values[k]
-      c.printf(buf)(`\\"${k}\\":`)
+      c.outLit(buf)(`"${k}":`)
       v.printJSON(buf)
       if (i != Object.keys(this.values).length - 1) {
-        c.printf(buf)(",")
+        c.outLit(buf)(",")
       }
     }
-    c.printf(buf)("}");
+    c.outLit(buf)("}");
   }
 }
 
@@ -285,15 +284,15 @@ class CKeys extends CCompoundValue {
   }
 
   printJSON(buf) {
-    c.printf(buf)("\\\"");
+    c.outLit(buf)("\"");
     for (let i in this.values) {
       let key = this.values[i]
       key.print(buf)
       if (i != this.values.length - 1) {
-        c.printf(buf)(",")
+        c.outLit(buf)(",")
       }
     }
-    c.printf(buf)("\\\"");
+    c.outLit(buf)("\"");
   }
 }
 
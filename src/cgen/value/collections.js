@@ -109,14 +109,14 @@ class CArray extends CCollection {
     limit = limit ? c.ternary(c.lt(limit, this.size), limit, this.size) : this.size
     let cType = utils.convertToCType(this.schema.objKey)
     let iter = symbol.getSymbol("print_iter")
-    c.printf(buf)("[")
+    c.outLit(buf)("[")
     buf.push(`for (${cType} ${iter} = 0; ${iter} < ${limit}; ${iter}++) {`)
     this.get(iter).printJSON(buf)
     c.if(buf)(c.ne(iter, c.sub(limit, 1)), buf1 => {
-      c.printf(buf1)(",")
+      c.outLit(buf1)(",")
     })
     buf.push("}")
-    c.printf(buf)("]")
+    c.outLit(buf)("]")
   }
 
   print(buf, limit) {
@@ -125,7 +125,7 @@ class CArray extends CCollection {
     let iter = symbol.getSymbol("print_iter")
     buf.push(`for (${cType} ${iter} = 0; ${iter} < ${limit}; ${iter}++) {`)
     this.get(iter).print(buf)
-    c.printf(buf)("\n")
+    c.outLit(buf)("\n")
     buf.push("}")
   }
 }
@@ -289,17 +289,17 @@ class CHashMap extends CCollection {
   printJSON(buf, limit) {
     limit = limit ? c.ternary(c.lt(limit, this.size), limit, this.size) : this.size
     let iter = symbol.getSymbol("print_iter")
-    c.printf(buf)("{")
+    c.outLit(buf)("{")
     buf.push(`for (int ${iter} = 1; ${iter} <= ${limit}; ${iter}++) {`)
     let entry = this.get(iter)
     entry.key.printJSON(buf, true)
-    c.printf(buf)(":")
+    c.outLit(buf)(":")
     entry.value.printJSON(buf)
     c.if(buf)(c.ne(iter, limit), buf1 => {
-      c.printf(buf1)(",")
+      c.outLit(buf1)(",")
     })
     buf.push("}")
-    c.printf(buf)("}")
+    c.outLit(buf)("}")
   }
 }
 
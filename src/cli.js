@@ -11,6 +11,27 @@ const readline = require('node:readline');
     // mode of operation: do we have a file/query given as arg?
     if (process.argv.length < 3 || process.argv[2] == "-h" || process.argv[2] == "--help") {
         console.log("usage: rhyme [file | query] args*")
+        console.log("       rhyme analyze file [--format csv|tbl|ndjson] [--catalog catalog.json]")
+        return
+    }
+
+    // ANALYZE: record statistics of an input file in the catalog
+    if (process.argv[2] == "analyze") {
+        try {
+            let args = process.argv.slice(3)
+            let options = {}
+            let files = []
+            for (let i = 0; i < args.length; i++) {
+                if (args[i] == "--format" || args[i] == "--catalog")
+                    options[args[i].substring(2)] = args[++i]
+                else
+                    files.push(args[i])
+            }
+            for (let file of files)
+                console.log(JSON.stringify({ [file]: api.analyze(file, undefined, options) }, null, 2))
+        } catch(e) {
+            console.error(e)
+        }
         return
     }
 
@@ -279,6 +279,8 @@ let deadCodeElimination = (q) => {
         return q;
     } else if (q.key === "loadInput") {
         return q;
+    } else if (q.key === "param") {
+        return q;
     } else if (q.key === "const") {
         return q;
     } else if (q.key === "var") {
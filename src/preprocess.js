@@ -79,6 +79,16 @@ let preproc = q => {
       console.error("unknown file format for loadInput " + q.xxkey.substring(4).toLowerCase())
     }
     return { key: "loadInput", op: q.xxkey.substring(4).toLowerCase(), arg: [e1], inputSchema: q.xxparam[1].xxop }
+  } else if (q.xxkey == "param") {
+    // Query parameter: a named value that is supplied when the query runs
+    let [name, type, maxLength] = q.xxparam
+    if (name === undefined || name.xxkey != "const" || typeof name.xxop != "string") {
+      console.error("constant parameter name expected for param")
+    }
+    if (type === undefined || type.xxkey != "hole") {
+      console.error("type expected for param " + name.xxop)
+    }
+    return { key: "param", op: name.xxop, paramType: type.xxop, maxLength: maxLength?.xxop }
   } else if (q.xxkey == "ident") {
     if (isVar(q.xxop)) return { key: "var", op: q.xxop }
     else return { key: "const", op: q.xxop }
@@ -43,6 +43,8 @@ let pretty = q => {
   } else if (q.key == "loadInput") {
     let [e1] = q.arg.map(pretty)
     return `loadInput('${q.op}', ${e1})`
+  } else if (q.key == "param") {
+    return `param('${q.op}')`
   } else if (q.key == "const") {
     if (typeof q.op === "object" && Object.keys(q.op).length == 0) return "{}"
     else return ""+q.op
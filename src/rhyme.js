@@ -12,6 +12,8 @@ const { types } = require('./typing')
 const { rh } = require('./parser')
 
 const { ops, ast } = require('./shared')
+const { shred } = require('./cgen/shred')
+const { catalog } = require('./cgen/catalog')
 
 //
 // ---------- Parser / quasiquote API ----------
@@ -56,6 +58,12 @@ api["group"] = (e,k) => api["object"](k,e)
 
 api["input"] = () => ast.wrap(ast.root())
 
+// query parameter, supplied when the compiled query runs:
+//   api.param("minPrice", types.f64)
+// the optional maxLength lets string params use the short string fast paths
+api["param"] = (name, type, maxLength) =>
+  ast.wrap(ast_op("param", [ast.str(name), ast.hole(type), ...(maxLength ? [ast.num(maxLength)] : [])]))
+
 
 //
 // ---------- Fluent syntax API ----------
@@ -67,6 +75,9 @@ api["input"] = () => ast.wrap(ast.root())
 let Pipe = {
   sum: function () { return pipe(api.sum(this)) },
   count: function () { return pipe(api.count(this)) },
+  countDistinct: function () { return pipe(api.countDistinct(this)) },
+  approxCountDistinct: function () { return pipe(api.approxCountDistinct(this)) },
+  median: function () { return pipe(api.median(this)) },
   max: function () { return pipe(api.max(this)) },
   first: function () { return pipe(api.first(this)) },
   last: function () { return pipe(api.last(this)) },
@@ -275,5 +286,11 @@ api["compileC2"] = (query, schema = types.unknown) => {
   return wrapper
 }
 
+// convert an NDJSON file into column files for the C backend's "shredded" setting
+api["shredNDJSON"] = (filename, schema, dir) => shred.shredNDJSON(filename, schema, dir)
+
+// record statistics of a CSV/TBL/NDJSON input in the catalog consulted by the C backend
+api["analyze"] = (filename, schema, options) => catalog.analyze(filename, schema, options)
+
 // displaying graphics/visualizations in the browser
 api["display"] = (o, domParent) => graphics.display(o, domParent)
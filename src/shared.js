@@ -69,6 +69,10 @@ ops.pure.dot = true
 ops.stateful.sum = true
 ops.stateful.product = true
 ops.stateful.count = true
+ops.stateful.countDistinct = true
+ops.stateful.approxCountDistinct = true
+ops.stateful.approxQuantile = true
+ops.stateful.median = true
 ops.stateful.max = true
 ops.stateful.min = true
 ops.stateful.array = true
@@ -84,6 +88,10 @@ ops.stateful.any = true
 ops.stateful["sum?"] = true
 ops.stateful["product?"] = true
 ops.stateful["count?"] = true
+ops.stateful["countDistinct?"] = true
+ops.stateful["approxCountDistinct?"] = true
+ops.stateful["approxQuantile?"] = true
+ops.stateful["median?"] = true
 ops.stateful["max?"] = true
 ops.stateful["min?"] = true
 ops.stateful["array?"] = true
@@ -133,6 +133,9 @@ let codegen = (q, scope) => {
   } else if (q.key == "loadInput") {
     let [e1] = q.arg.map(x => codegen(x,scope))
     return "rt.load" + q.op.toUpperCase() + "(" + e1 + ")"
+  } else if (q.key == "param") {
+    // parameters are fields of the input in the JS backends
+    return "inp?.[" + quoteConst(q.op) + "]"
   } else if (q.key == "const") {
     return quoteConst(q.op)
   } else if (q.key == "var") {
@@ -211,8 +214,8 @@ let emitStmUpdate = (q, scope) => {
     // XXX TODO: add prefix wrapper?
     return "rt.stateful.prefix(rt.stateful."+q.op+"("+e1+"))"
   } else if (q.key == "stateful") {
-    let [e1] = q.arg.map(x => codegen(x, scope))
-    return "rt.stateful."+q.op+"("+e1+")"
+    let es = q.arg.map(x => codegen(x, scope))
+    return "rt.stateful."+q.op+"("+es.join(",")+")"
   } else if (q.key == "update") {
     // let e0 = codegen(q.arg[0], scope)
     let e2 = codegen(q.arg[2], scope)
@@ -178,6 +178,21 @@ let extract0 = q => {
       //       { key: "get", arg: [prefix, v2] }, e2]}]} ]}
     } else
       return { ...q, key: "update", arg: [e0,e1,e2], mode: mode }
+  } else if (q.key == "stateful" && q.op.startsWith("countDistinct") && settings.backend == "js") {
+    // desugar countDistinct(e) as the number of keys of { e: true }
+    let op = q.op.endsWith("?") ? "count?" : "count"
+    let set = { key: "group", arg: [q.arg[0], { key: "const", op: true }] }
+    return extract0({ key: "stateful", op, arg: [{ key: "get", arg: [set, { key: "var", op: "*" }] }] })
+  } else if (q.key == "stateful" && settings.backend == "js" && ["approxCountDistinct", "approxQuantile", "median"].includes(q.op.replace("?", ""))) {
+    // desugar into a stateful op that builds the sketch and a pure op that
+    // reads the estimate from it (see rt.sketch)
+    let maybe = q.op.endsWith("?") ? "?" : ""
+    let op = q.op.replace("?", "")
+    if (op == "approxCountDistinct")
+      return extract0({ key: "pure", op: "hllEstimate", arg: [{ ...q, op: "hllSketch" + maybe }] })
+    let p = op == "median" ? { key: "const", op: 0.5 } : q.arg[1]
+    let sketch = { ...q, op: "quantileSketch" + maybe, arg: [q.arg[0]] }
+    return extract0({ key: "pure", op: "sketchQuantile", arg: [sketch, p] })
   } else if (q.key == "stateful" && q.op.endsWith("?")) {
     let es = q.arg.map(extract0)
     return { ...q, op: q.op.slice(0,-1), mode: "maybe", arg: es }
@@ -360,7 +375,7 @@ let extract3 = q => {
 //
 
 let inferDims = q => {
-  if (q.key == "input" || q.key == "const" || q.key == "placeholder") {
+  if (q.key == "input" || q.key == "const" || q.key == "placeholder" || q.key == "param") {
     q.vars = []
     q.mind = []
     q.dims = []
@@ -440,7 +455,7 @@ let assertSame = (a,b,msg) => console.assert(same(a,b), msg+": "+a+" != "+b)
 
 // infer bound vars (simple mode)
 let inferBound = out => q => {
-  if (q.key == "input" || q.key == "const" || q.key == "placeholder") {
+  if (q.key == "input" || q.key == "const" || q.key == "placeholder" || q.key == "param") {
     q.bnd = []
   } else if (q.key == "var") {
     q.bnd = []
@@ -490,7 +505,7 @@ let inferBound = out => q => {
 
 // infer free vars (simple mode)
 let inferFree = out => q => {
-  if (q.key == "input" || q.key == "const" || q.key == "placeholder") {
+  if (q.key == "input" || q.key == "const" || q.key == "placeholder" || q.key == "param") {
     q.fre = []
   } else if (q.key == "var") {
     // check that variables are always defined -- currently not for K vars
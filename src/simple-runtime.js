@@ -306,6 +306,10 @@ rt.stateful.count = x => s => {
   return s + 1
 }
 
+// countDistinct is desugared into a count over a nested group-by for this
+// runtime (see extract0 in simple-eval), only its initial value is shared
+rt.stateful.countDistinct_init = () => 0
+
 rt.stateful.min_init = () => Number.POSITIVE_INFINITY
 
 rt.stateful.min = x => s => {
@@ -385,6 +389,30 @@ rt.stateful.mkset = x => s => {
   return s
 }
 
+// approximate aggregates: approxCountDistinct, approxQuantile and median
+// are desugared into a stateful op that builds a sketch and a pure op that
+// reads its estimate (see extract0 in simple-eval)
+
+rt.stateful.approxCountDistinct_init = () => 0
+
+rt.stateful.hllSketch = (x, p) => s => {
+  if (x === undefined) return s
+  s ??= rt.sketch.hllCreate(p)
+  rt.sketch.hllAdd(s, typeof x == "string" ? x : JSON.stringify(x))
+  return s
+}
+
+rt.stateful.quantileSketch = x => s => {
+  if (x === undefined) return s
+  s ??= rt.sketch.tdigestCreate()
+  rt.sketch.tdigestAdd(s, Number(x))
+  return s
+}
+
+rt.pure.hllEstimate = s => s === undefined ? 0 : Math.round(rt.sketch.hllEstimate(s))
+
+rt.pure.sketchQuantile = (s, q) => s === undefined ? undefined : rt.sketch.tdigestQuantile(s, q)
+
 
 // sum, count, min, max, 
 // first, last, single, unique
@@ -402,6 +430,125 @@ rt.stateful.prefix = fold => s => {
 
 
 
+// sketches
+//
+// mergeable summaries with bounded size, the same as in rhyme-c.h. Strings
+// are hashed as there, numbers by their JSON text (the C code hashes the
+// bits of their C type, so their estimates may differ).
+
+rt.sketch = {}
+
+// HyperLogLog with 2^p registers over a 64-bit hash of the string
+rt.sketch.hllCreate = (p = 12) => ({ p, registers: new Uint8Array(1 << p) })
+
+// hash() of rhyme-c.h (djb2 over the UTF-8 bytes as signed chars) followed
+// by spill_mix, as a 64-bit BigInt
+rt.sketch.hash64 = (str) => {
+  let h = 5381n
+  for (let b of new TextEncoder().encode(str))
+    h = BigInt.asUintN(64, h * 33n + BigInt(b << 24 >> 24))
+  h ^= h >> 33n
+  h = BigInt.asUintN(64, h * 0xff51afd7ed558ccdn)
+  h ^= h >> 33n
+  h = BigInt.asUintN(64, h * 0xc4ceb9fe1a85ec53n)
+  h ^= h >> 33n
+  return h
+}
+
+rt.sketch.hllAdd = (s, str) => {
+  let h = rt.sketch.hash64(str)
+  let idx = Number(h >> BigInt(64 - s.p))
+  let rest = BigInt.asUintN(64, h << BigInt(s.p))
+  let hi = Number(rest >> 32n)
+  let clz = hi ? Math.clz32(hi) : 32 + Math.clz32(Number(rest & 0xffffffffn))
+  let rank = rest ? clz + 1 : 64 - s.p + 1
+  if (rank > s.registers[idx]) s.registers[idx] = rank
+}
+
+rt.sketch.hllMerge = (s, other) => {
+  for (let i = 0; i < s.registers.length; i++)
+    if (other.registers[i] > s.registers[i]) s.registers[i] = other.registers[i]
+  return s
+}
+
+rt.sketch.hllEstimate = (s) => {
+  let m = s.registers.length
+  let sum = 0
+  let zeros = 0
+  for (let r of s.registers) {
+    sum += Math.pow(2, -r)
+    if (r == 0) zeros++
+  }
+  let est = 0.7213 / (1 + 1.079 / m) * m * m / sum
+  // small cardinalities: linear counting
+  if (est <= 2.5 * m && zeros > 0) est = m * Math.log(m / zeros)
+  return est
+}
+
+// Merging t-digest with the arcsine scale function: values are buffered
+// and merged into about `compression` centroids
+rt.sketch.tdigestCreate = (compression = 100) =>
+  ({ compression, centroids: [], total: 0, min: Infinity, max: -Infinity, merged: 0 })
+
+rt.sketch.tdigestAdd = (s, x, weight = 1) => {
+  if (s.centroids.length == 6 * s.compression) rt.sketch.tdigestCompress(s)
+  s.centroids.push({ mean: x, weight })
+  s.total += weight
+  if (x < s.min) s.min = x
+  if (x > s.max) s.max = x
+}
+
+rt.sketch.tdigestCompress = (s) => {
+  if (s.merged == s.centroids.length) return
+  let scale = q => s.compression / (2 * Math.PI) * Math.asin(2 * q - 1)
+  let cs = s.centroids.sort((a, b) => a.mean - b.mean)
+  let out = [{ ...cs[0] }]
+  let before = 0
+  for (let c of cs.slice(1)) {
+    let cur = out[out.length - 1]
+    let weight = cur.weight + c.weight
+    if (scale((before + weight) / s.total) - scale(before / s.total) <= 1) {
+      cur.mean += (c.mean - cur.mean) * c.weight / weight
+      cur.weight = weight
+    } else {
+      before += cur.weight
+      out.push({ ...c })
+    }
+  }
+  s.centroids = out
+  s.merged = out.length
+}
+
+rt.sketch.tdigestMerge = (s, other) => {
+  for (let c of other.centroids) rt.sketch.tdigestAdd(s, c.mean, c.weight)
+  s.min = Math.min(s.min, other.min)
+  s.max = Math.max(s.max, other.max)
+  return s
+}
+
+// Interpolates between the centers of the centroids, and the extremes
+rt.sketch.tdigestQuantile = (s, q) => {
+  rt.sketch.tdigestCompress(s)
+  let cs = s.centroids
+  if (cs.length == 0) return undefined
+  if (cs.length == 1) return cs[0].mean
+  let target = q * s.total
+  if (target <= cs[0].weight / 2)
+    return s.min + (cs[0].mean - s.min) * target / (cs[0].weight / 2)
+  let before = 0
+  for (let i = 0; i < cs.length - 1; i++) {
+    let left = before + cs[i].weight / 2
+    let right = before + cs[i].weight + cs[i + 1].weight / 2
+    if (target <= right)
+      return cs[i].mean + (cs[i + 1].mean - cs[i].mean) * (target - left) / (right - left)
+    before += cs[i].weight
+  }
+  let last = cs[cs.length - 1]
+  let left = s.total - last.weight / 2
+  return last.mean + (s.max - last.mean) * (target - left) / (last.weight / 2)
+}
+
+
 // group and update
 
 // these are dealt with somewhat specially
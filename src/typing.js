@@ -808,6 +808,8 @@ let _validateIRQuery = (schema, cseMap, varMap, nonEmptyGuarantees, q) => {
             throw new Error("Filename in loadInput expected to be a string but got " + prettyPrintType(t1))
         }
         return {type: q.inputSchema, props: argTups[0].props};
+    } else if (q.key === "param") {
+        return intoTup(q.paramType);
     } else if (q.key === "const") {
         if (typeof q.op === "object" && Object.keys(q.op).length === 0)
             return intoTup(objBuilder().build());
@@ -1082,6 +1084,10 @@ let _validateIRQuery = (schema, cseMap, varMap, nonEmptyGuarantees, q) => {
         } else if (q.op == "length") {
             let {type: t1, props: p1} = argTups[0];
             return {type: types.u64, props: union(p1, nothingSet)};
+        } else if (q.op == "hllEstimate") {
+            return {type: types.u32, props: argTups[0].props};
+        } else if (q.op == "sketchQuantile") {
+            return {type: types.f64, props: argTups[0].props};
         } else if (q.op == "dot") {
             let {type: t1, props: p1} = argTups[0];
             let {type: t2, props: p2} = argTups[1];
@@ -1175,9 +1181,16 @@ let _validateIRQuery = (schema, cseMap, varMap, nonEmptyGuarantees, q) => {
 
             return  {type: argType, props: argTup.props};
 
-        } else if (q.op === "count") {
+        } else if (q.op === "count" || q.op === "countDistinct" || q.op === "approxCountDistinct") {
             // As long as the argument is valid, it doesn't matter what type it is.
             return {type: types.u32, props: props};
+        } else if (q.op === "approxQuantile" || q.op === "median") {
+            if (!isUnknown(argType) && !isNumber(argType))
+                throw new Error(`Unable to ${q.op} non-number values currently. Got: ${prettyPrintType(argType)}`);
+            return {type: types.f64, props: props};
+        } else if (q.op === "hllSketch" || q.op === "quantileSketch") {
+            // Sketches of the js backend, read by hllEstimate and sketchQuantile.
+            return {type: types.unknown, props: props};
         } else if (q.op === "all" || q.op === "any") {
             if (!isUnknown(argType) && !isBoolean(argType))
                 throw new Error(`Unable to use "all" operator on non-boolean type. Got: ${prettyPrintType(argType)}`);
@@ -1588,6 +1601,8 @@ let convertAST = (schema, q, completedMap, dontConvertVar = false) => {
         return q;
     } else if (q.key === "loadInput") {
         return q;
+    } else if (q.key === "param") {
+        return q;
     } else if (q.key == "const") {
         return q;
     } else if (q.key == "var") {
@@ -1706,7 +1721,7 @@ let convertAST = (schema, q, completedMap, dontConvertVar = false) => {
         } else if (q.op === "like") {
             q.arg = q.arg.map($convertAST);
             return q;
-        } else if (q.op == "length") {
+        } else if (q.op == "length" || q.op == "hllEstimate" || q.op == "sketchQuantile") {
             q.arg = q.arg.map($convertAST);
             return q;
         } else if (q.op == "singleton") {
@@ -247,3 +247,316 @@ test("arrayTest3", async () => {
   let expected = { A: [{ foo: 10 }, { foo: 30 }], B: [{ foo: 20 }] }
   expect(JSON.parse(res)).toEqual(expected)
 })
+
+//
+// ----- Streaming top-level JSON arrays
+//
+
+test("streamGroupByTest", async () => {
+  let query = rh`{
+    ${data}.*.key: sum(${data}.*.value)
+  }`
+
+  // use a tiny buffer so that elements span multiple reads
+  let func = await compile(query, { backend: "c", outDir, outFile: "streamGroupByTest", enableOptimizations: false, streamJSON: true, streamBufferSize: 8 })
+  let res = await func()
+
+  expect(JSON.parse(res)).toEqual({ "A": 40, "B": 20 })
+})
+
+test("streamNestedGroupAggregateTest", async () => {
+  let query = rh`{
+    ${country}.*.region: {
+      ${country}.*.city: sum(${country}.*.population)
+    }
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "streamNestedGroupAggregateTest", enableOptimizations: false, streamJSON: true })
+  let res = await func()
+
+  let expected = {
+    "Asia": { "Beijing": 20, "Tokyo": 30 },
+    "Europe": { "London": 10, "Paris": 10 }
+  }
+  expect(JSON.parse(res)).toEqual(expected)
+})
+
+//
+// ----- Binary results
+//
+
+test("binaryGroupByTest", async () => {
+  let query = rh`{
+    ${data}.*.key: sum(${data}.*.value) / sum(${data}.*B.value)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "binaryGroupByTest", enableOptimizations: false, format: "binary" })
+  let res = await func()
+
+  // no rounding from text formatting
+  expect(res).toEqual({ "A": 2 / 3, "B": 1 / 3 })
+})
+
+test("binaryGroupByColumnarTest", async () => {
+  let query = rh`{
+    ${data}.*.key: sum(${data}.*.value)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "binaryGroupByColumnarTest", enableOptimizations: false, format: "binary" })
+  let res = await func({}, { columnar: true })
+
+  expect(res.count).toBe(2)
+  expect(res.keys[0].data).toEqual(["A", "B"])
+  expect(res.values.data).toEqual(new Uint32Array([40, 20]))
+})
+
+test("binaryNestedGroupAggregateTest", async () => {
+  let query = rh`{
+    ${country}.*.region: {
+      ${country}.*.city: sum(${country}.*.population)
+    }
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "binaryNestedGroupAggregateTest", enableOptimizations: false, format: "binary" })
+  let res = await func()
+
+  let expected = {
+    "Asia": { "Beijing": 20, "Tokyo": 30 },
+    "Europe": { "London": 10, "Paris": 10 }
+  }
+  expect(res).toEqual(expected)
+})
+
+test("binaryArrayTest", async () => {
+  let query = rh`[{
+    city: ${country}.*.city,
+    population: ${country}.*.population
+  }]`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "binaryArrayTest", enableOptimizations: false, format: "binary" })
+  let res = await func()
+
+  let func1 = await compile(query, { backend: "c", outDir, outFile: "binaryArrayTestJSON", enableOptimizations: false })
+  expect(res).toEqual(JSON.parse(await func1()))
+})
+
+//
+// ----- Compiled binary cache
+//
+
+test("binaryCacheTest", async () => {
+  let query = rh`{
+    ${data}.*.key: sum(${data}.*.value)
+  }`
+
+  let settings = { backend: "c", outDir, outFile: "binaryCacheTest", enableOptimizations: false, cache: true, cacheDir: `${outDir}/cache` }
+
+  let func1 = await compile(query, settings)
+  expect(func1.explain.cache.hit).toBe(false)
+
+  await sh(`rm ${outDir}/binaryCacheTest`)
+  let func2 = await compile(query, settings)
+  expect(func2.explain.cache.hit).toBe(true)
+  expect(func2.explain.cache.key).toBe(func1.explain.cache.key)
+  expect(JSON.parse(await func2())).toEqual({ "A": 40, "B": 20 })
+
+  // different flags produce a different binary
+  let func3 = await compile(query, { ...settings, cFlags: "-Icgen-sql -O2" })
+  expect(func3.explain.cache.hit).toBe(false)
+})
+
+//
+// ----- Query parameters
+//
+
+test("paramFilterTest", async () => {
+  let region = api.param("region", types.string, 8)
+  let minPopulation = api.param("minPopulation", types.u32)
+  let query = rh`{
+    (${country}.*A.region == ${region}) & (${country}.*A.population >= ${minPopulation}) & ${country}.*A.city:
+      sum(${country}.*A.population)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "paramFilterTest", enableOptimizations: false })
+  expect(func.explain.params).toEqual(["region", "minPopulation"])
+
+  // the same binary is run with different values
+  expect(JSON.parse(await func({ region: "Asia", minPopulation: 0 }))).toEqual({ Tokyo: 30, Beijing: 20 })
+  expect(JSON.parse(await func({ region: "Asia", minPopulation: 25 }))).toEqual({ Tokyo: 30 })
+  expect(JSON.parse(await func({ region: "Europe", minPopulation: 10 }))).toEqual({ Paris: 10, London: 10 })
+  expect(JSON.parse(await func({ region: "Africa", minPopulation: 0 }))).toEqual({})
+})
+
+test("paramFilenameTest", async () => {
+  let filename = api.param("filename", types.string)
+  let query = rh`sum (loadJSON ${filename} ${dataSchema}).*.value`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "paramFilenameTest", enableOptimizations: false })
+  expect(JSON.parse(await func({ filename: "./cgen-sql/json/basic/data.json" }))).toBe(60)
+})
+
+//
+// ----- Resident server mode
+//
+
+test("serverParamTest", async () => {
+  let region = api.param("region", types.string, 8)
+  let query = rh`{
+    (${country}.*A.region == ${region}) & ${country}.*A.city: sum(${country}.*A.population)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "serverParamTest", enableOptimizations: false, server: true })
+
+  // requests share the loaded input but not the query state
+  expect(JSON.parse(await func({ region: "Asia" }))).toEqual({ Tokyo: 30, Beijing: 20 })
+  expect(JSON.parse(await func({ region: "Asia" }))).toEqual({ Tokyo: 30, Beijing: 20 })
+  let [res1, res2] = await Promise.all([func({ region: "Europe" }), func({ region: "Africa" })])
+  expect(JSON.parse(res1)).toEqual({ Paris: 10, London: 10 })
+  expect(JSON.parse(res2)).toEqual({})
+
+  func.close()
+})
+
+test("serverBinaryTest", async () => {
+  let query = rh`{
+    ${data}.*.key: sum(${data}.*.value)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "serverBinaryTest", enableOptimizations: false, server: true, format: "binary" })
+
+  expect(await func()).toEqual({ "A": 40, "B": 20 })
+  expect(await func()).toEqual({ "A": 40, "B": 20 })
+
+  func.close()
+})
+
+//
+// ----- Tiered compilation
+//
+
+test("tieredCompileTest", async () => {
+  let query = rh`{
+    ${country}.*A.region: {
+      ${country}.*A.city: sum(${country}.*A.population)
+    }
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "tieredCompileTest", enableOptimizations: false, tiered: true })
+  let expected = { Asia: { Tokyo: 30, Beijing: 20 }, Europe: { Paris: 10, London: 10 } }
+  expect(JSON.parse(await func())).toEqual(expected)
+
+  await func.optimized
+  expect(func.explain.tier).toBe(1)
+  expect(JSON.parse(await func())).toEqual(expected)
+})
+
+//
+// ----- Profile-guided optimization
+//
+
+test("pgoTest", async () => {
+  let region = api.param("region", types.string)
+  let query = rh`{
+    (${country}.*A.region == ${region}) & ${country}.*A.city: sum(${country}.*A.population)
+  }`
+
+  let settings = { backend: "c", outDir, outFile: "pgoTest", enableOptimizations: false, pgo: { params: { region: "Asia" }, runs: 1 }, cache: true, cacheDir: `${outDir}/cache` }
+  let func = await compile(query, settings)
+  expect(func.explain.pgo.speedup).toBeGreaterThan(0)
+  expect(JSON.parse(await func({ region: "Europe" }))).toEqual({ Paris: 10, London: 10 })
+
+  // the profile-optimized binary is taken from the cache
+  let func1 = await compile(query, settings)
+  expect(func1.explain.cache.hit).toBe(true)
+  expect(func1.explain.pgo).toEqual(func.explain.pgo)
+})
+
+//
+// ----- Runtime instrumentation
+//
+
+test("instrumentTest", async () => {
+  let query = rh`{
+    (${country}.*A.population > 10) & ${country}.*A.city: sum(${country}.*A.population)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "instrumentTest", enableOptimizations: false, instrument: true })
+  expect(JSON.parse(await func())).toEqual({ Tokyo: 30, Beijing: 20 })
+
+  let report = func.explain.instrument
+  expect(Object.keys(report.phases)).toEqual(["load", "init", "loops", "sort", "print"])
+
+  let byKind = kind => report.groups.filter(g => g.kind == kind)
+  expect(byKind("generator")[0].counters.rows).toBe(4)
+  expect(byKind("stateful")[0].counters.updates).toBe(2)
+  expect(byKind("filter")[0].counters.passed).toBe(2)
+  let map = byKind("hashmap").find(g => g.counters.inserts == 2)
+  expect(map.expr).toContain("mkset")
+})
+
+test("serverInstrumentTest", async () => {
+  let query = rh`sum ((${country}.*A.population > 10) & ${country}.*A.population)`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "serverInstrumentTest", enableOptimizations: false, server: true, instrument: true })
+
+  // each request reports its own counters
+  for (let k = 0; k < 2; k++) {
+    expect(JSON.parse(await func())).toBe(50)
+    let groups = func.explain.instrument.groups
+    expect(groups.find(g => g.kind == "generator").counters.rows).toBe(4)
+    expect(groups.find(g => g.kind == "filter").counters.passed).toBe(2)
+  }
+
+  func.close()
+})
+
+test("perfCountersTest", async () => {
+  let query = rh`sum ${data}.*.value`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "perfCountersTest", enableOptimizations: false, perfCounters: true })
+  expect(JSON.parse(await func())).toBe(60)
+
+  // counters read as zero where perf events are not available
+  let perf = func.explain.perf
+  expect(Object.keys(perf)).toEqual(["available", "Initialization", "Runtime", "Total"])
+  expect(Object.keys(perf.Runtime)).toEqual(["cycles", "instructions", "cache_misses", "branch_misses", "ipc"])
+})
+
+test("memoryStatsTest", async () => {
+  let query = rh`{
+    ${country}.*A.city: sum(${country}.*A.population)
+  }`
+
+  let func = await compile(query, { backend: "c", outDir, outFile: "memoryStatsTest", enableOptimizations: false, memoryStats: true, hashSize: 64 })
+  expect(JSON.parse(await func())).toEqual({ Tokyo: 30, Beijing: 20, Paris: 10, London: 10 })
+
+  let report = func.explain.memory
+  expect(report.peakRss).toBeGreaterThan(0)
+  let map = report.structures.find(s => s.buffers.some(b => b.name == "htable"))
+  expect(map.expr).toContain("mkset")
+  let htable = map.buffers.find(b => b.name == "htable")
+  expect(htable).toEqual({ name: "htable", entrySize: 4, allocations: 1, reserved: 256, used: 16 })
+  expect(map.reserved).toBe(map.buffers.reduce((acc, b) => acc + b.reserved, 0))
+  expect(report.used).toBeLessThan(report.reserved)
+})
+
+test("autoSizeTest", async () => {
+  let query = rh`{
+    ${country}.*A.city: sum(${country}.*A.population)
+  }`
+
+  let settings = { backend: "c", outDir, outFile: "autoSizeTest", enableOptimizations: false, autoSize: true, cacheDir: `${outDir}/autoSizeCache`, memoryStats: true }
+  await sh(`rm -rf ${outDir}/autoSizeCache`)
+
+  let func1 = await compile(query, settings)
+  expect(JSON.parse(await func1())).toEqual({ Tokyo: 30, Beijing: 20, Paris: 10, London: 10 })
+  expect(func1.explain.autoSize.observedCounts).toEqual({})
+  let htable1 = func1.explain.memory.structures.find(s => s.buffers.some(b => b.name == "htable"))
+
+  // the next compilation sizes the hashmap from the 4 keys seen
+  let func2 = await compile(query, settings)
+  expect(JSON.parse(await func2())).toEqual({ Tokyo: 30, Beijing: 20, Paris: 10, London: 10 })
+  expect(Object.values(func2.explain.autoSize.observedCounts)).toEqual([4])
+  let htable2 = func2.explain.memory.structures.find(s => s.buffers.some(b => b.name == "htable"))
+  expect(htable2.reserved).toBeLessThan(htable1.reserved)
+})
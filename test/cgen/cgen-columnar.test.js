@@ -0,0 +1,147 @@
+const { api, rh } = require('../../src/rhyme')
+const { compile } = require('../../src/simple-eval')
+const { typing, types } = require('../../src/typing')
+const { shred } = require('../../src/cgen/shred')
+
+const os = require('child_process')
+
+let sh = (cmd) => {
+  return new Promise((resolve, reject) => {
+    os.exec(cmd, (err, stdout) => {
+      if (err) {
+        reject(err)
+      } else {
+        resolve(stdout)
+      }
+    })
+  })
+}
+
+let outDir = "cgen-sql/out/columnar"
+
+let key = typing.createKey(types.u32)
+
+let schema = typing.parseType({
+  "-": typing.keyval(key, {
+    did: types.string,
+    time_us: types.u64,
+    kind: types.string,
+    commit: {
+      operation: types.string,
+      collection: types.string,
+      rkey: types.string,
+      record: types.unknown
+    }
+  })
+})
+
+let filename = `${outDir}/events.ndjson`
+
+beforeAll(async () => {
+  await sh(`rm -rf ${outDir}`)
+  await sh(`mkdir -p ${outDir}`)
+  await sh(`cp cgen-sql/json/columnar/events.ndjson ${filename}`)
+  api.shredNDJSON(filename, schema)
+})
+
+let events = rh`loadNDJSON "cgen-sql/out/columnar/events.ndjson" ${schema}`
+
+let settings = { backend: "c", outDir, enableOptimizations: false }
+
+// Run the query on the NDJSON file and on its shredded columns
+let compileBoth = async (query, outFile) => {
+  let func1 = await compile(query, { ...settings, outFile: outFile + "_ndjson" })
+  let func2 = await compile(query, { ...settings, outFile: outFile + "_shredded", shredded: true })
+  return [JSON.parse(await func1()), JSON.parse(await func2())]
+}
+
+test("shredMetaTest", () => {
+  let meta = require(`../../${filename}.cols/meta.json`)
+  expect(meta.rows).toBe(7)
+  // commit.record has unknown type and is not shredded
+  expect(meta.columns.map(col => col.path.join("."))).toEqual([
+    "did", "time_us", "kind", "commit.operation", "commit.collection", "commit.rkey"
+  ])
+})
+
+test("splitLinesUtf8Test", async () => {
+  // with 4 byte chunks multi-byte characters straddle chunk boundaries
+  let lines = ["{\"a\": \"héllo\"}", "{\"a\": \"日本語\"}", "{\"a\": \"🦀\"}"]
+  await sh(`printf '%s\\n' ${lines.map(l => `'${l}'`).join(" ")} > ${outDir}/utf8.ndjson`)
+  let res = []
+  shred.splitLines(`${outDir}/utf8.ndjson`, line => res.push(line), 4)
+  expect(res).toEqual(lines)
+})
+
+test("shreddedGroupCountTest", async () => {
+  let query = rh`{
+    ${events}.*A.commit.collection || "(null)": count(${events}.*A)
+  }`
+
+  let [res1, res2] = await compileBoth(query, "shreddedGroupCountTest")
+  expect(res2).toEqual({
+    "app.bsky.feed.like": 3,
+    "app.bsky.feed.post": 1,
+    "(null)": 2,
+    "app.bsky.graph.follow": 1
+  })
+  expect(res2).toEqual(res1)
+})
+
+test("shreddedMissingValuesTest", async () => {
+  let query = rh`{
+    ${events}.*A.kind: {
+      users: count(${events}.*A.did),
+      times: count(${events}.*A.time_us),
+      keys: count(${events}.*A.commit.rkey)
+    }
+  }`
+
+  let [res1, res2] = await compileBoth(query, "shreddedMissingValuesTest")
+  expect(res2).toEqual({
+    commit: { users: 5, times: 4, keys: 3 },
+    identity: { users: 1, times: 1, keys: 0 },
+    account: { users: 1, times: 0, keys: 0 }
+  })
+  expect(res2).toEqual(res1)
+})
+
+test("shreddedFilterTest", async () => {
+  let query = rh`{
+    ${events}.*A.did: max(${events}.*A.time_us)
+  }`
+
+  let [res1, res2] = await compileBoth(query, "shreddedFilterTest")
+  expect(res2).toEqual(res1)
+})
+
+test("shreddedOutOfDateTest", async () => {
+  await sh(`cp cgen-sql/json/columnar/events.ndjson ${outDir}/stale.ndjson`)
+  api.shredNDJSON(`${outDir}/stale.ndjson`, schema)
+  await sh(`echo '{"did":"did:plc:f"}' >> ${outDir}/stale.ndjson`)
+
+  let query = rh`count (loadNDJSON "cgen-sql/out/columnar/stale.ndjson" ${schema}).*A.did`
+  expect(() => compile(query, { ...settings, outFile: "shreddedOutOfDateTest", shredded: true })).toThrow("out of date")
+})
+
+test("vectorizedAggregateTest", async () => {
+  let query = rh`{
+    total: sum ${events}.*A.time_us,
+    recent: count (${events}.*A.time_us > 1732206349000500) & ${events}.*A.did,
+    first: min ${events}.*A.time_us,
+    last: max ${events}.*A.time_us,
+    doubled: sum ((${events}.*A.time_us > 1732206349000200) & ${events}.*A.time_us + ${events}.*A.time_us)
+  }`
+
+  let func1 = await compile(query, { ...settings, outFile: "vectorizedAggregateTest", shredded: true })
+  let func2 = await compile(query, { ...settings, outFile: "vectorizedAggregateTest_vec", shredded: true, vectorized: true })
+  let code = await sh(`cat ${outDir}/vectorizedAggregateTest_vec.c`)
+  expect(code).toContain("(vectorized)")
+  // the filters narrow a selection vector, the arithmetic runs on vectors
+  expect(code).toContain("vec_sel_vs(")
+  expect(code).toContain("vec_arith_vv(")
+
+  let res = JSON.parse(await func2())
+  expect(res).toEqual(JSON.parse(await func1()))
+  expect(res.first).toBeLessThan(res.last)
+})
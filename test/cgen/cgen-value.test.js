@@ -269,8 +269,8 @@ test("testHashMap4", async () => {
   nestedL1.declareStruct(code)
   map.declare(code)
 
-  let key1 = new value.CString(types.string, `"key1"`, 5)
-  let key2 = new value.CString(types.string, `"key2"`, 5)
+  let key1 = new value.CString(types.string, `"key1"`, 4)
+  let key2 = new value.CString(types.string, `"key2"`, 4)
   let key3 = new value.CPrim(types.i32, "42")
 
   map.findAndInsert(code, key1, (buf, entry) => {
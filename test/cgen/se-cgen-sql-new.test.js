@@ -627,4 +627,309 @@ test("testArraySorting", async () => {
   expect(JSON.parse(res)).toEqual([{ C: 0 }, { C: 13 }, { C: 92 }, { C: 123 }])
 })
 
+test("sortSpecializedTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/simple.csv" ${schema}`
+
+  // a single integer column is radix sorted
+  let query = rh`sort [{A: ${csv}.*A.A, C: ${csv}.*A.C}] "C" 1`
+  let func = await compile(query, { backend: "c", outDir, outFile: "sortSpecializedTest1", schema: types.never, enableOptimization: false })
+  expect(JSON.parse(await func()).map(e => e.C)).toEqual([123, 92, 13, 0])
+  expect(await sh(`cat ${outDir}/sortSpecializedTest1.c`)).toContain("radix_sort(")
+
+  // other sorts use an introsort specialized for the compare function
+  query = rh`sort [{D: ${csv}.*A.D % 2, String: ${csv}.*A.String}] "D" 0 "String" 1`
+  func = await compile(query, { backend: "c", outDir, outFile: "sortSpecializedTest2", schema: types.never, enableOptimization: false })
+  expect(JSON.parse(await func()).map(e => e.String)).toEqual(["valD", "string3", "string2", "string1"])
+  expect(await sh(`cat ${outDir}/sortSpecializedTest2.c`)).toContain("RHYME_DEFINE_SORT(")
+})
+
+test("sortNormalizedKeysTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/simple.csv" ${schema}`
+
+  let query = rh`sort [{D: ${csv}.*A.D % 2, B: ${csv}.*A.B, String: ${csv}.*A.String}] "D" 1 "String" 0 "B" 0`
+  let func = await compile(query, { backend: "c", outDir, outFile: "sortNormalizedKeysTest", schema: types.never, enableOptimization: false, normalizedSortKeys: true })
+  expect(JSON.parse(await func()).map(e => e.String)).toEqual(["string1", "string2", "string3", "valD"])
+  expect(await sh(`cat ${outDir}/sortNormalizedKeysTest.c`)).toContain("sortkey_put_str(")
+})
+
+test("sortParallelTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/simple.csv" ${schema}`
+
+  // with a threshold of 0 every sort runs on the threads
+  let query = rh`sort [{B: ${csv}.*A.B % 2, String: ${csv}.*A.String}] "B" 0 "String" 1`
+  let func = await compile(query, { backend: "c", outDir, outFile: "sortParallelTest", schema: types.never, enableOptimization: false, sortThreads: 3, parallelSortThreshold: 0 })
+  expect(JSON.parse(await func()).map(e => e.String)).toEqual(["string2", "valD", "string3", "string1"])
+  expect(await sh(`cat ${outDir}/sortParallelTest.c`)).toContain("parallel_sort(")
+})
+
+test("sortExternalTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/simple.csv" ${schema}`
+
+  // a budget of two 12 byte records (key and index) per run spills two runs,
+  // which are merged while the result is printed
+  let query = rh`sort [{C: ${csv}.*A.C}] "C" 1`
+  let func = await compile(query, { backend: "c", outDir, outFile: "sortExternalTest", schema: types.never, enableOptimization: false, sortMemory: 24 })
+  expect(JSON.parse(await func())).toEqual([{ C: 123 }, { C: 92 }, { C: 13 }, { C: 0 }])
+  let code = await sh(`cat ${outDir}/sortExternalTest.c`)
+  expect(code).toContain("sort_merge_next(")
+  expect(code).toContain("sort_merge_free(")
+
+  // string keys are stored as a 16 byte prefix, two records per run
+  let group = rh`{ A: single ${csv}.*A.A, D: sum ${csv}.*A.D } | group ${csv}.*A.A`
+  func = await compile(rh`sort ${group} "A" 1`, { backend: "c", outDir, outFile: "sortExternalTest1", schema: types.never, sortMemory: 40 })
+  expect(Object.keys(JSON.parse(await func()))).toEqual(["valD", "valC", "valB", "valA"])
+})
+
+test("sortLimitTopKTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/simple.csv" ${schema}`
+
+  // only the first two entries are selected, the rest is never sorted
+  let query = rh`sort [{C: ${csv}.*A.C}] "C" 1`
+  let func = await compile(query, { backend: "c", outDir, outFile: "sortLimitTopKTest1", schema: types.never, enableOptimization: false, limit: 2 })
+  expect(JSON.parse(await func())).toEqual([{ C: 123 }, { C: 92 }])
+  expect(await sh(`cat ${outDir}/sortLimitTopKTest1.c`)).toContain("topk_sort(")
+
+  let group = rh`{ A: single ${csv}.*A.A, D: sum ${csv}.*A.D } | group ${csv}.*A.A`
+  query = rh`sort ${group} "D" 0`
+  func = await compile(query, { backend: "c", outDir, outFile: "sortLimitTopKTest2", schema: types.never, limit: 3 })
+  expect(JSON.parse(await func())).toEqual({ valC: { A: "valC", D: 0 }, valA: { A: "valA", D: 1 }, valB: { A: "valB", D: 2 } })
+
+  // a limit larger than the result keeps all entries
+  func = await compile(query, { backend: "c", outDir, outFile: "sortLimitTopKTest3", schema: types.never, limit: 10 })
+  expect(Object.keys(JSON.parse(await func()))).toEqual(["valC", "valA", "valB", "valD"])
+})
+
+test("groupMemorySpillTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/country.csv" ${countrySchema}`
+  let query = rh`{ n: count ${csv}.*.city, max: max ${csv}.*.population } | group ${csv}.*.country`
+
+  // one group at a time: the partial aggregates are spilled to partition
+  // files in a single scan, each file is merged until its groups fit
+  let func = await compile(query, { backend: "c", outDir, outFile: "groupMemorySpillTest", schema: types.never, groupMemory: 1 })
+  expect(func.explain.spill).toEqual({ maxGroups: 1 })
+  let code = await sh(`cat ${outDir}/groupMemorySpillTest.c`)
+  expect(code).toContain("spill_file(")
+  expect(code).not.toContain("goto")
+  expect(JSON.parse(await func())).toEqual({
+    Japan: { n: 1, max: 30 }, China: { n: 1, max: 20 }, France: { n: 1, max: 10 }, UK: { n: 1, max: 10 }
+  })
+
+  // the first city of each population, two groups share a population
+  query = rh`{ n: count ${csv}.*.city, city: first ${csv}.*.city } | group ${csv}.*.population`
+  func = await compile(query, { backend: "c", outDir, outFile: "groupMemorySpillTest1", schema: types.never, groupMemory: 1 })
+  expect(JSON.parse(await func())).toEqual({
+    30: { n: 1, city: "Tokyo" }, 20: { n: 1, city: "Beijing" }, 10: { n: 2, city: "Paris" }
+  })
+})
+
+test("streamingGroupTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/country.csv" ${countrySchema}`
+  let query = rh`{ n: count ${csv}.*.city, max: max ${csv}.*.population } | group ${csv}.*.population`
+
+  // the rows of each population are contiguous, each run is printed when it ends
+  let func = await compile(query, {
+    backend: "c", outDir, outFile: "streamingGroupTest", schema: types.never,
+    sortedInputs: { "./cgen-sql/country.csv": ["population"] }
+  })
+  expect(func.explain.streamGroup).toEqual({ group: "tmp2" })
+  expect(await func()).toBe(`{"30":{"n":1,"max":30},"20":{"n":1,"max":20},"10":{"n":2,"max":10}}`)
+
+  // the order found by analyze is used only with catalogSortOrder, and a
+  // missing value (read as 0) breaks it
+  let catalog = `${outDir}/catalog.json`
+  await sh(`printf 'country,city,population\\nChina,Beijing,5\\nJapan,Tokyo,5\\nUK,London,7\\n' > ${outDir}/runs.csv`)
+  await sh(`printf 'country,city,population\\nChina,Beijing,5\\nJapan,Tokyo,\\nUK,London,5\\n' > ${outDir}/runs1.csv`)
+  expect(api.analyze(`./${outDir}/runs.csv`, countrySchema, { catalog }).columns.population.sorted).toBe(true)
+  expect(api.analyze(`./${outDir}/runs1.csv`, countrySchema, { catalog }).columns.population.sorted).toBeUndefined()
+
+  let runs = rh`loadCSV "./cgen-sql/out/sql-new/runs.csv" ${countrySchema}`
+  query = rh`count ${runs}.*.city | group ${runs}.*.population`
+  func = await compile(query, { backend: "c", outDir, outFile: "streamingGroupTest1", schema: types.never, catalog })
+  expect(func.explain.streamGroup).toBeUndefined()
+  func = await compile(query, { backend: "c", outDir, outFile: "streamingGroupTest2", schema: types.never, catalog, catalogSortOrder: true })
+  expect(func.explain.streamGroup).toEqual({ group: "tmp1" })
+  expect(JSON.parse(await func())).toEqual({ 5: 2, 7: 1 })
+
+  let runs1 = rh`loadCSV "./cgen-sql/out/sql-new/runs1.csv" ${countrySchema}`
+  query = rh`count ${runs1}.*.city | group ${runs1}.*.population`
+  func = await compile(query, { backend: "c", outDir, outFile: "streamingGroupTest3", schema: types.never, catalog, catalogSortOrder: true })
+  expect(func.explain.streamGroup).toBeUndefined()
+  expect(JSON.parse(await func())).toEqual({ 5: 2, 0: 1 })
+
+  // NDJSON events sorted by time, also with a generator over the items of
+  // each event
+  await sh(`printf '%s\\n' '{"t":1,"v":3,"items":[1,2]}' '{"t":1,"v":4,"items":[]}' '{"t":2,"v":5,"items":[5]}' '{"t":4,"v":1,"items":[1,1,1]}' > ${outDir}/events.ndjson`)
+  let eventSchema = typing.parseType("{*u32: {t: u32, v: i32, items: {*u32: i32}}}")
+  let events = rh`loadNDJSON "cgen-sql/out/sql-new/events.ndjson" ${eventSchema}`
+  query = rh`{ v: sum ${events}.*.v, items: count ${events}.*.items.*i } | group ${events}.*.t`
+  func = await compile(query, {
+    backend: "c", outDir, outFile: "streamingGroupTest4", schema: types.never,
+    sortedInputs: { "cgen-sql/out/sql-new/events.ndjson": ["t"] }
+  })
+  expect(func.explain.streamGroup).toEqual({ group: "tmp2" })
+  expect(JSON.parse(await func())).toEqual({ 1: { v: 7, items: 2 }, 2: { v: 5, items: 1 }, 4: { v: 1, items: 3 } })
+})
+
+test("countDistinctTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/country.csv" ${countrySchema}`
+  let query = rh`{ cities: countDistinct ${csv}.*.city, countries: countDistinct ${csv}.*.country } | group ${csv}.*.population`
+
+  // one set of (group, value) pairs per op instead of a nested hashmap per group
+  let func = await compile(query, { backend: "c", outDir, outFile: "countDistinctTest", schema: types.never })
+  let code = await sh(`cat ${outDir}/countDistinctTest.c`)
+  expect(code).toContain("distinct_add(")
+  let expected = { 10: { cities: 2, countries: 2 }, 20: { cities: 1, countries: 1 }, 30: { cities: 1, countries: 1 } }
+  expect(JSON.parse(await func())).toEqual(expected)
+
+  // the js backend counts the keys of a nested group-by
+  let data = [
+    { country: "Japan", city: "Tokyo", population: 30 }, { country: "China", city: "Beijing", population: 20 },
+    { country: "France", city: "Paris", population: 10 }, { country: "UK", city: "London", population: 10 }
+  ]
+  let jsQuery = rh`{ cities: countDistinct data.*.city, countries: countDistinct data.*.country } | group data.*.population`
+  expect(compile(jsQuery)({ data })).toEqual(expected)
+})
+
+test("approxAggregatesTest", async () => {
+  let csv = rh`loadCSV "./cgen-sql/country.csv" ${countrySchema}`
+  let query = rh`{ countries: approxCountDistinct ${csv}.*.country, median: median ${csv}.*.population, top: (approxQuantile ${csv}.*.population 1) }`
+
+  // a HyperLogLog and a t-digest per group, the results are written after the loops
+  let func = await compile(query, { backend: "c", outDir, outFile: "approxAggregatesTest", schema: types.never })
+  let code = await sh(`cat ${outDir}/approxAggregatesTest.c`)
+  expect(code).toContain("hll_finish(")
+  expect(code).toContain("tdigest_finish(")
+  let expected = { countries: 4, median: 15, top: 30 }
+  expect(JSON.parse(await func())).toEqual(expected)
+
+  let grouped = rh`{ cities: approxCountDistinct ${csv}.*.city, median: median ${csv}.*.population } | group ${csv}.*.country`
+  func = await compile(grouped, { backend: "c", outDir, outFile: "approxAggregatesTest1", schema: types.never })
+  expect(JSON.parse(await func())).toEqual({
+    Japan: { cities: 1, median: 30 }, China: { cities: 1, median: 20 }, France: { cities: 1, median: 10 }, UK: { cities: 1, median: 10 }
+  })
+
+  // the js backend keeps the same sketches as the state of the op
+  let data = [
+    { country: "Japan", city: "Tokyo", population: 30 }, { country: "China", city: "Beijing", population: 20 },
+    { country: "France", city: "Paris", population: 10 }, { country: "UK", city: "London", population: 10 }
+  ]
+  let jsQuery = rh`{ countries: approxCountDistinct data.*.country, median: median data.*.population, top: (approxQuantile data.*.population 1) }`
+  expect(compile(jsQuery)({ data })).toEqual(expected)
+
+  // strings are hashed the same way, so both backends estimate the same
+  // count beyond the range of linear counting
+  let names = Array.from({ length: 20000 }, (_, i) => ({ name: `name_${i % 15000}` }))
+  await sh(`awk 'BEGIN { print "name"; for (i = 0; i < 20000; i++) print "name_" (i % 15000) }' > ${outDir}/names.csv`)
+  let namesSchema = typing.objBuilder().add(typing.createKey(types.u32), typing.createSimpleObject({ name: types.string })).build()
+  let names1 = rh`loadCSV "./cgen-sql/out/sql-new/names.csv" ${namesSchema}`
+  func = await compile(rh`approxCountDistinct ${names1}.*.name`, { backend: "c", outDir, outFile: "approxAggregatesTest2", schema: types.never })
+  let estimate = JSON.parse(await func())
+  expect(Math.abs(estimate - 15000) < 15000 * 0.05).toBe(true)
+  expect(compile(rh`approxCountDistinct data.*.name`)({ data: names })).toBe(estimate)
+})
+
+test("analyzeCatalogTest", async () => {
+  let catalog = `${outDir}/catalog.json`
+  let stats = api.analyze("./cgen-sql/country.csv", countrySchema, { catalog })
+  expect(stats.rows).toBe(4)
+  expect(stats.columns.city).toEqual({ type: "string", count: 4, nullFraction: 0, distinct: 4, min: "Beijing", max: "Tokyo", avgLength: 5.75 })
+  expect(stats.columns.population.distinct).toBe(3)
+  expect([stats.columns.population.min, stats.columns.population.max]).toEqual([10, 30])
+
+  let csv = rh`loadCSV "./cgen-sql/country.csv" ${countrySchema}`
+  let query = rh`count ${csv}.*.city | group ${csv}.*.population`
+
+  // the hash table is sized for the 3 distinct populations
+  let func = await compile(query, { backend: "c", outDir, outFile: "analyzeCatalogTest", schema: types.never, catalog, memoryStats: true })
+  expect(JSON.parse(await func())).toEqual({ 10: 2, 20: 1, 30: 1 })
+  expect(Object.values(func.explain.keyEstimates)).toEqual([3])
+  let map = func.explain.memory.structures.find(s => s.buffers.some(b => b.name == "htable"))
+  expect(map.buffers.find(b => b.name == "htable").reserved).toBe(16 * 4)
+
+  // an explicit hashSize is kept, the populations 10..30 fit into it and
+  // index the table directly
+  func = await compile(query, { backend: "c", outDir, outFile: "analyzeCatalogTest1", schema: types.never, catalog, memoryStats: true, hashSize: 64 })
+  expect(JSON.parse(await func())).toEqual({ 10: 2, 20: 1, 30: 1 })
+  map = func.explain.memory.structures.find(s => s.buffers.some(b => b.name == "htable"))
+  expect(map.buffers.find(b => b.name == "htable").reserved).toBe(64 * 4)
+  let code = await sh(`cat ${outDir}/analyzeCatalogTest1.c`)
+  expect(code).toContain(" - (10)")
+
+  // the catalog is only read when given
+  func = await compile(query, { backend: "c", outDir, outFile: "analyzeCatalogTest2", schema: types.never })
+  expect(func.explain.keyEstimates).toEqual({})
+})
+
+test("mergeJoinTest", async () => {
+  await sh(`printf 'id,name,limit\\n1,ann,10\\n2,bob,20\\n4,cy,40\\n7,dan,70\\n' > ${outDir}/customers.csv`)
+  await sh(`printf 'cid,name,amount\\n1,ann,1\\n1,ann,2\\n3,cat,3\\n4,cy,4\\n4,cy,5\\n8,eve,6\\n' > ${outDir}/orders.csv`)
+  let customerSchema = typing.parseType("{*u32: {id: u32, name: string, limit: i32}}")
+  let orderSchema = typing.parseType("{*u32: {cid: u32, name: string, amount: i32}}")
+  let customers = rh`loadCSV "./cgen-sql/out/sql-new/customers.csv" ${customerSchema}`
+  let orders = rh`loadCSV "./cgen-sql/out/sql-new/orders.csv" ${orderSchema}`
+  let sortedInputs = {
+    "./cgen-sql/out/sql-new/customers.csv": ["id"],
+    "./cgen-sql/out/sql-new/orders.csv": ["cid"]
+  }
+
+  // both inputs are sorted on the join key, the lookups of the orders move
+  // forward over the customer keys
+  let build = rh`{ limit: max ${customers}.*c.limit } | group ${customers}.*c.id`
+  let query = rh`sum (${orders}.*o.amount + ${build}.(${orders}.*o.cid).limit) | group ${orders}.*o.name`
+  let func = await compile(query, { backend: "c", outDir, outFile: "mergeJoinTest", schema: types.never, sortedInputs })
+  expect(func.explain.mergeJoins).toEqual(["tmp1"])
+  let code = await sh(`cat ${outDir}/mergeJoinTest.c`)
+  expect(code).toContain("tmp1_merge_pos")
+  expect(JSON.parse(await func())).toEqual({ ann: 23, cat: 0, cy: 89, eve: 0 })
+
+  // a build input that is not in ascending order is an error
+  await sh(`printf 'id,name,limit\\n1,ann,10\\n4,cy,40\\n2,bob,20\\n' > ${outDir}/customers1.csv`)
+  let customers1 = rh`loadCSV "./cgen-sql/out/sql-new/customers1.csv" ${customerSchema}`
+  let build1 = rh`{ limit: max ${customers1}.*c.limit } | group ${customers1}.*c.id`
+  query = rh`sum (${orders}.*o.amount + ${build1}.(${orders}.*o.cid).limit)`
+  sortedInputs["./cgen-sql/out/sql-new/customers1.csv"] = ["id"]
+  func = await compile(query, { backend: "c", outDir, outFile: "mergeJoinTest1", schema: types.never, sortedInputs })
+  let err
+  try {
+    await func()
+  } catch (e) {
+    err = e
+  }
+  expect(err.message).toContain("not in ascending order")
+})
+
+test("radixJoinTest", async () => {
+  let catalog = `${outDir}/catalog.json`
+  api.analyze("./cgen-sql/country.csv", countrySchema, { catalog })
+
+  let csv = rh`loadCSV "./cgen-sql/country.csv" ${countrySchema}`
+  let build = rh`{ max: max ${csv}.*o.population } | group ${csv}.*o.country`
+  let query = rh`sum (${csv}.*l.population + ${build}.(${csv}.*l.country).max) | group ${csv}.*l.city`
+
+  // the 4 countries estimated for the build side reach the threshold and
+  // exceed the partition size, both inputs are partitioned once and joined
+  // one partition at a time
+  let func = await compile(query, {
+    backend: "c", outDir, outFile: "radixJoinTest", schema: types.never, catalog,
+    radixJoinThreshold: 4, joinPartitionBytes: 64
+  })
+  expect(func.explain.radixJoin.partitions).toBe(4)
+  let code = await sh(`cat ${outDir}/radixJoinTest.c`)
+  expect(code).toContain("radix_add(")
+  expect(JSON.parse(await func())).toEqual({ Beijing: 40, Paris: 20, London: 20, Tokyo: 60 })
+
+  // below the threshold, or without an estimate, the table is not partitioned
+  func = await compile(query, { backend: "c", outDir, outFile: "radixJoinTest1", schema: types.never, catalog, radixJoinThreshold: 5, joinPartitionBytes: 64 })
+  expect(func.explain.radixJoin).toBeUndefined()
+  func = await compile(query, { backend: "c", outDir, outFile: "radixJoinTest2", schema: types.never, radixJoinThreshold: 4, joinPartitionBytes: 64 })
+  expect(func.explain.radixJoin).toBeUndefined()
+
+  // radixJoin forces or disables it
+  func = await compile(query, { backend: "c", outDir, outFile: "radixJoinTest3", schema: types.never, radixJoin: true, joinPartitionBytes: 64 })
+  expect(func.explain.radixJoin.build).toBe("tmp1")
+  expect(JSON.parse(await func())).toEqual({ Beijing: 40, Paris: 20, London: 20, Tokyo: 60 })
+  func = await compile(query, { backend: "c", outDir, outFile: "radixJoinTest4", schema: types.never, catalog, radixJoin: false, radixJoinThreshold: 4, joinPartitionBytes: 64 })
+  expect(func.explain.radixJoin).toBeUndefined()
+})
+
 /**/
\ No newline at end of file
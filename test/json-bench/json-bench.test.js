@@ -84,16 +84,14 @@ test("q2", async () => {
     ${cond} & ${bluesky}.*A.commit.collection: {
       event: single(${bluesky}.*A.commit.collection),
       count: count(${bluesky}.*A),
-      dids: {
-        ${bluesky}.*A.did: count?(${cond} & ${bluesky}.*A.did)
-      }
+      users: countDistinct?(${cond} & ${bluesky}.*A.did)
     }
   }`
 
   let group = rh`{
     event: single ${countDistinct}.*B.event,
     count: single ${countDistinct}.*B.count,
-    users: count ${countDistinct}.*B.dids.*C
+    users: single ${countDistinct}.*B.users
   } | group ${countDistinct}.*B.event`
 
   let query = rh`sort ${group} "count" 1`